@@ -48,10 +48,11 @@ bool GenericWindow::on_key_release_event(GdkEventKey *event) {
     case GDK_KP_Subtract: {
       int w, h;
       view->get_window()->get_size(w, h);
-      if(event->keyval == GDK_equal || event->keyval == GDK_KP_Add)
-        view->Zoom(w / 2.0, h / 2.0, M_SQRT1_2);
+      const bool in = event->keyval == GDK_equal || event->keyval == GDK_KP_Add;
+      if(View::zoom2)
+        view->Zoom2(w / 2, h / 2, in ? 1 : -1);
       else
-        view->Zoom(w / 2.0, h / 2.0, M_SQRT2);
+        view->Zoom(w / 2.0, h / 2.0, in ? M_SQRT1_2 : M_SQRT2);
       controls->UpdateDisplay();
       view->NewLocation(w / 2, h / 2);
       return true;
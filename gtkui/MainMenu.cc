@@ -100,15 +100,19 @@ public:
 
 class WindowsMenu: public Gtk::Menu {
 public:
-  WindowsMenu(): juliaItem("Julia set") {
+  WindowsMenu(): juliaItem("Julia set"), heatmapItem("Tile heatmap") {
     append(juliaItem);
     juliaItem.signal_toggled().connect(sigc::mem_fun(*this, &WindowsMenu::JuliaToggled));
+    append(heatmapItem);
+    heatmapItem.signal_toggled().connect(sigc::mem_fun(*this, &WindowsMenu::HeatmapToggled));
   }
 
   Gtk::CheckMenuItem juliaItem;
+  Gtk::CheckMenuItem heatmapItem;
 
   virtual void on_show() {
     juliaItem.set_active(julia && julia->property_visible());
+    heatmapItem.set_active(mandelbrot->view.GetHeatmap());
     Gtk::Menu::on_show();
   }
 
@@ -120,6 +124,13 @@ public:
         julia->hide();
     }
   }
+
+  // Overlay tile compute times on both views
+  void HeatmapToggled() {
+    mandelbrot->view.SetHeatmap(heatmapItem.get_active());
+    if(julia)
+      julia->view.SetHeatmap(heatmapItem.get_active());
+  }
 };
 
 // Help menu ----------------------------------------------------------------
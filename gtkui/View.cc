@@ -26,6 +26,9 @@
 #include "arith.h"
 
 namespace mmui {
+int View::preview = 8;
+bool View::zoom2 = false;
+
 View::View() {
   set_size_request(384, 384);
   add_events(Gdk::BUTTON_PRESS_MASK | Gdk::BUTTON_RELEASE_MASK | Gdk::POINTER_MOTION_MASK);
@@ -37,7 +40,10 @@ bool View::on_button_press_event(GdkEventButton *event) {
   // Double-click left button zooms in
   if(event->type == GDK_2BUTTON_PRESS && event->button == 1
      && !(event->state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_LOCK_MASK))) {
-    Zoom(event->x, event->y, M_SQRT1_2);
+    if(zoom2)
+      Zoom2(event->x, event->y, 1);
+    else
+      Zoom(event->x, event->y, M_SQRT1_2);
     if(controls)
       controls->UpdateDisplay();
     NewLocation();
@@ -48,7 +54,10 @@ bool View::on_button_press_event(GdkEventButton *event) {
      && ((event->button == 3 && !(event->state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_LOCK_MASK)))
          || ((event->button == 1
               && (event->state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_LOCK_MASK)) == GDK_CONTROL_MASK)))) {
-    Zoom(event->x, event->y, M_SQRT2);
+    if(zoom2)
+      Zoom2(event->x, event->y, -1);
+    else
+      Zoom(event->x, event->y, M_SQRT2);
     if(controls)
       controls->UpdateDisplay();
     NewLocation();
@@ -160,8 +169,10 @@ void View::NewPixels() {
   NewPixels(0, 0, w, h);
 }
 
-// Recolor a region of the view
-void View::NewPixels(int px, int py, int pw, int ph) {
+// Recolor a region of the view.  Pixels that haven't been computed yet take
+// the color of the nearest preview pixel up and to the left, if step is more
+// than 1, or are left alone otherwise.
+void View::NewPixels(int px, int py, int pw, int ph, int step) {
   guint8 *pixels = pixbuf->get_pixels();
   const int rowstride = pixbuf->get_rowstride();
   const int lx = px + pw;
@@ -170,8 +181,12 @@ void View::NewPixels(int px, int py, int pw, int ph) {
     count_t *datarow = &dest->pixel(px, y);
     guchar *pixelrow = pixels + y * rowstride + px * 3;
     for(int x = px; x < lx; ++x) {
-      const count_t count = *datarow++;
-      if(count < maxiters) {
+      count_t count = *datarow++;
+      if(std::isnan(count) && step > 1)
+        count = dest->pixel(x - x % step, y - y % step);
+      if(std::isnan(count))
+        pixelrow += 3;
+      else if(count < maxiters) {
         *pixelrow++ = red(count, maxiters);
         *pixelrow++ = green(count, maxiters);
         *pixelrow++ = blue(count, maxiters);
@@ -184,6 +199,45 @@ void View::NewPixels(int px, int py, int pw, int ph) {
   }
 }
 
+// Heatmap ------------------------------------------------------------------
+
+void View::SetHeatmap(bool enable) {
+  if(enable == heatmap)
+    return;
+  heatmap = enable;
+  if(pixbuf)
+    Retint();
+}
+
+// Blend a tile with a color running from blue (fast) to red (the slowest
+// tile so far)
+void View::Tint(const TileStats &t) {
+  const double heat = slowest > 0 ? t.elapsed / slowest : 0;
+  const int r = 255 * heat, b = 255 * (1 - heat);
+  guint8 *pixels = pixbuf->get_pixels();
+  const int rowstride = pixbuf->get_rowstride();
+  for(int y = t.y; y < t.y + t.h; ++y) {
+    guchar *pixelrow = pixels + y * rowstride + t.x * 3;
+    for(int x = t.x; x < t.x + t.w; ++x) {
+      pixelrow[0] = (pixelrow[0] + r) / 2;
+      pixelrow[1] = pixelrow[1] / 2;
+      pixelrow[2] = (pixelrow[2] + b) / 2;
+      pixelrow += 3;
+    }
+  }
+}
+
+// Recolor all completed tiles, with or without the heatmap
+void View::Retint() {
+  for(size_t n = 0; n < tiles.size(); ++n) {
+    const TileStats &t = tiles[n];
+    NewPixels(t.x, t.y, t.w, t.h);
+    if(heatmap)
+      Tint(t);
+  }
+  Redraw(0, 0, pixbuf->get_width(), pixbuf->get_height());
+}
+
 // Job completion callback
 void View::Completed(Job *generic_job, void *data) {
   struct timespec finished;
@@ -193,8 +247,31 @@ void View::Completed(Job *generic_job, void *data) {
   // Ignore stale jobs
   if(j->dest != v->dest)
     return;
+  // Paint previews scaled up, leaving anything finer that's already arrived
+  if(j->step > 1) {
+    v->NewPixels(j->x, j->y, j->w, j->h, j->step);
+    v->Redraw(j->x, j->y, j->w, j->h);
+    return;
+  }
+  v->tiles.push_back(TileStats(j));
   v->NewPixels(j->x, j->y, j->w, j->h);
-  v->Redraw(j->x, j->y, j->w, j->h);
+  if(v->heatmap) {
+    if(j->elapsed > v->slowest) {
+      // The scale has changed, so redo everything
+      v->slowest = j->elapsed;
+      v->Retint();
+    } else {
+      v->Tint(v->tiles.back());
+      v->Redraw(j->x, j->y, j->w, j->h);
+    }
+  } else
+    v->Redraw(j->x, j->y, j->w, j->h);
+  // Paint anything the job copied by symmetry
+  int mx, my, mw, mh;
+  if(j->mirrored(mx, my, mw, mh)) {
+    v->NewPixels(mx, my, mw, mh);
+    v->Redraw(mx, my, mw, mh);
+  }
   double elapsed_time = finished.tv_sec - v->started.tv_sec + (finished.tv_nsec - v->started.tv_nsec) / 1000000000.0;
   char buffer[64];
   snprintf(buffer, sizeof buffer, "%gs", elapsed_time);
@@ -205,25 +282,69 @@ void View::Completed(Job *generic_job, void *data) {
 
 // Called to set a new location, scale or maxiters
 void View::NewLocation(int xpos, int ypos) {
-  if(!property_visible())
+  if(!property_visible()) {
+    reuse = false;
     return;
-  if(dest) {
-    dest->release();
-    dest = NULL;
   }
+  // If the view has only been dragged or zoomed by 2, pixels that are still
+  // in view are reused
+  const bool moved = reuse && (reuseX || reuseY || reuseZoom);
+  IterBuffer *previous = dest;
+  dest = NULL;
   int w, h;
   get_window()->get_size(w, h);
   if(!pixbuf)
     pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, w, h);
-  // TODO if there's a pixbuf available then ideally we would move or scale it
-  // to provide continuity.
+  // TODO if there's a pixbuf available then ideally we would scale it to
+  // provide continuity.  (Pans and 2x zooms are dealt with below.)
   if(xpos == -1 || ypos == -1)
     get_pointer(xpos, ypos);
   // Discard stale work
   Job::cancel(this);
+  tiles.clear();
+  slowest = 0;
   clock_gettime(CLOCK_REALTIME, &started);
-  dest =
-      FractalJob::recompute(xcenter, ycenter, radius, maxiters, w, h, arith, Completed, this, xpos, ypos, jobFactory);
+  dest = FractalJob::recompute(xcenter,
+                               ycenter,
+                               radius,
+                               maxiters,
+                               w,
+                               h,
+                               arith,
+                               Completed,
+                               this,
+                               xpos,
+                               ypos,
+                               jobFactory,
+                               job_interactive,
+                               preview,
+                               moved ? previous : nullptr,
+                               reuseX,
+                               reuseY,
+                               reuseZoom);
+  if(previous)
+    previous->release();
+  if(moved && pixbuf->get_width() == w && pixbuf->get_height() == h) {
+    // Move the picture to match, with the newly exposed areas mid-grey
+    Glib::RefPtr<Gdk::Pixbuf> newPixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, false, 8, w, h);
+    memset(newPixbuf->get_pixels(), 0x80, newPixbuf->get_rowstride() * h);
+    // new = old * scale + offset, with the zoom center fixed
+    const double scale = reuseZoom > 0 ? 2 : reuseZoom < 0 ? 0.5 : 1;
+    const double offset_x = reuseZoom ? reuseX * (1 - scale) : reuseX;
+    const double offset_y = reuseZoom ? reuseY * (1 - scale) : reuseY;
+    const int x0 = std::max((int)ceil(offset_x), 0), x1 = std::min((int)floor(offset_x + w * scale), w);
+    const int y0 = std::max((int)ceil(offset_y), 0), y1 = std::min((int)floor(offset_y + h * scale), h);
+    if(x0 < x1 && y0 < y1)
+      pixbuf->scale(newPixbuf, x0, y0, x1 - x0, y1 - y0, offset_x, offset_y, scale, scale, Gdk::INTERP_NEAREST);
+    pixbuf = newPixbuf;
+    // GDK's nearest-neighbour sampling can pick the pixel next to the one
+    // that was copied, and copied pixels may never be repainted by a job, so
+    // color them from the data.  The rest of the scaled image is a preview.
+    NewPixels(0, 0, w, h);
+    Redraw(0, 0, w, h);
+  }
+  reuse = true;
+  reuseX = reuseY = reuseZoom = 0;
 }
 
 void View::NewSize() {
@@ -279,16 +400,30 @@ void View::NewSize() {
 
 // Motion -------------------------------------------------------------------
 
+// Move by a whole number of pixels, exactly, so that NewLocation can reuse
+// the pixels that are still in view
 void View::Drag(int deltax, int deltay) {
   int w, h;
   get_window()->get_size(w, h);
-  if(w > h) {
-    xcenter -= arith_t(deltax) * radius * 2 / h;
-    ycenter += arith_t(deltay) * radius * 2 / h;
-  } else {
-    xcenter -= arith_t(deltax) * radius * 2 / w;
-    ycenter += arith_t(deltay) * radius * 2 / w;
-  }
+  const arith_t pixel = FractalJob::pixel_size(radius, w, h);
+  xcenter -= arith_t(deltax) * pixel;
+  ycenter += arith_t(deltay) * pixel;
+  if(reuseZoom)
+    reuse = false;
+  reuseX += deltax;
+  reuseY += deltay;
+}
+
+// Zoom in (zoom = 1) or out (zoom = -1) by exactly 2 about a pixel, so that
+// NewLocation can reuse pixels from the current view
+void View::Zoom2(int xpos, int ypos, int zoom) {
+  int w, h;
+  get_window()->get_size(w, h);
+  const bool exact = FractalJob::zoom2(xcenter, ycenter, radius, w, h, xpos, ypos, zoom);
+  reuse = reuse && exact && !reuseX && !reuseY && !reuseZoom;
+  reuseX = xpos;
+  reuseY = ypos;
+  reuseZoom = zoom;
 }
 
 void View::Zoom(arith_t x, arith_t y, arith_t scale) {
@@ -341,6 +476,7 @@ void View::Zoom(arith_t x, arith_t y, arith_t scale) {
     ycenter -= radius * (arith_t(1) - scale) * (y * 2 - h) / w;
   }
   radius *= scale;
+  reuse = false;
 }
 
 void View::Save() {
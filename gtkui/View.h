@@ -22,10 +22,7 @@
 #include <gtkmm/drawingarea.h>
 #pragma GCC diagnostic pop
 #include "arith.h"
-
-class IterBuffer;
-class FractalJobFactory;
-class Job;
+#include "FractalJob.h"
 
 namespace mmui {
 
@@ -44,6 +41,7 @@ public:
   void NewSize();
   void Drag(int deltax, int deltay);
   void Zoom(arith_t x, arith_t y, arith_t scale);
+  void Zoom2(int xpos, int ypos, int zoom);
   inline void SetControlPanel(ControlPanel *p) {
     controls = p;
   }
@@ -55,12 +53,24 @@ public:
 
   void Save();
 
+  // Show how long each tile took to compute
+  void SetHeatmap(bool enable);
+  inline bool GetHeatmap() const {
+    return heatmap;
+  }
+
   // Parameters
   arith_t xcenter = 0, ycenter = 0, radius = 2;
   int maxiters = 255;
   arith_type arith = ARITH_DEFAULT;
   std::string arith_string = arith_names[ARITH_DEFAULT];
 
+  // Spacing of preview pixels for new locations; 1 to disable previews
+  static int preview;
+
+  // True to zoom by exact factors of 2, reusing pixels
+  static bool zoom2;
+
   // Results
   arith_t xpointer = 0, ypointer = 0, count = 0;
   std::string elapsed;
@@ -71,13 +81,23 @@ private:
   Glib::RefPtr<Gdk::Pixbuf> pixbuf;
 
   void Redraw(int x, int y, int w, int h);
-  void NewPixels(int x, int y, int w, int h);
+  void NewPixels(int x, int y, int w, int h, int step = 1);
   void NewPixels();
   static void Completed(Job *generic_job, void *completion_data);
   struct timespec started;
 
+  // Tile timing
+  std::vector<TileStats> tiles; // completed tiles for dest
+  double slowest = 0;           // longest tile time
+  bool heatmap = false;         // true to overlay tile times
+  void Tint(const TileStats &t);
+  void Retint();
+
   // Dragging support
   bool dragging = false;
+  bool reuse = true;    // false if dest's pixels can't be reused
+  int reuseX = 0, reuseY = 0; // pan distance, or zoom center
+  int reuseZoom = 0;    // 1 after zooming in, -1 out, 0 after panning
   double dragFromX = 0, dragFromY = 0;
   double dragToX = 0, dragToY = 0;
   sigc::connection dragIdleConnection;
@@ -19,19 +19,23 @@
 #include "Draw.h"
 #include <gtkmm/main.h>
 #include <getopt.h>
+#include <cstring>
 
 mmui::MandelbrotWindow *mmui::mandelbrot;
 mmui::JuliaWindow *mmui::julia;
 
+// Maximum completions to deliver per main loop iteration
+static const int batch = 256;
+
 static sigc::connection pollAgainConnection;
 
 static bool pollAgainHandler() {
-  bool more = Job::poll(1);
+  bool more = Job::poll(batch);
   return more;
 }
 
-static bool periodic() {
-  bool more = Job::poll(1);
+static bool completions(Glib::IOCondition) {
+  bool more = Job::poll(batch);
   if(more && !pollAgainConnection.connected())
     pollAgainConnection = Glib::signal_idle().connect(sigc::ptr_fun(pollAgainHandler));
   return true;
@@ -39,16 +43,26 @@ static bool periodic() {
 
 static const struct option options[] = {{"help", no_argument, NULL, 'h'},
                                         {"threads", required_argument, NULL, 't'},
+                                        {"placement", required_argument, NULL, 'p'},
                                         {"draw", no_argument, NULL, 'd'},
                                         {"dive", no_argument, NULL, 'D'},
+                                        {"tile-stats", required_argument, NULL, 'T'},
+                                        {"preview", required_argument, NULL, 'P'},
+                                        {"zoom2", no_argument, NULL, 'z'},
+                                        {"antialias", required_argument, NULL, 'a'},
+                                        {"interior", no_argument, NULL, 'i'},
+                                        {"strategy", required_argument, NULL, 's'},
                                         {NULL, 0, NULL, 0}};
 
 int main(int argc, char **argv) {
   Gtk::Main kit(argc, argv);
   int nthreads = -1, mode = 0;
+  job_placement placement = placement_none;
+  const char *statsPath = nullptr;
+  int antialias = 0;
 
   int n;
-  while((n = getopt_long(argc, argv, "+ht:dD", options, NULL)) >= 0) {
+  while((n = getopt_long(argc, argv, "+ht:p:dDT:P:za:is:", options, NULL)) >= 0) {
     switch(n) {
     case 'h':
       printf("Usage:\n"
@@ -60,16 +74,53 @@ int main(int argc, char **argv) {
              "  --help, -h        Display help message\n"
              "  --draw, -d        Draw one image and terminate\n"
              "  --dive, -D        Create a video and terminate\n"
-             "  --threads, -t N   Set maximum number of threads\n");
+             "  --threads, -t N   Set maximum number of threads\n"
+             "  --placement, -p P Worker placement: none, cores, nodes\n"
+             "  --tile-stats, -T PATH  With --draw, write per-tile timings to PATH\n"
+             "  --preview, -P N   Show a 1/N resolution preview first (default 8)\n"
+             "  --zoom2, -z       Zoom by factors of 2, reusing pixels\n"
+             "  --antialias, -a N With --draw or --dive, add NxN samples at edges\n"
+             "  --interior, -i    Detect interior points from their orbits' derivatives\n"
+             "  --strategy, -s S  Tile strategy: subdivide, trace\n");
       return 0;
     case 't': nthreads = atoi(optarg); break;
+    case 'p':
+      for(placement = placement_none; placement < placement_limit; placement = job_placement(placement + 1))
+        if(!strcmp(placement_names[placement], optarg))
+          break;
+      if(placement == placement_limit)
+        fatal(0, "unknown placement '%s'", optarg);
+      break;
     case 'd':
     case 'D': mode = n; break;
+    case 'T': statsPath = optarg; break;
+    case 'P':
+      mmui::View::preview = atoi(optarg);
+      if(mmui::View::preview < 1)
+        fatal(0, "invalid preview '%s'", optarg);
+      break;
+    case 'z': mmui::View::zoom2 = true; break;
+    case 'a':
+      antialias = atoi(optarg);
+      if(antialias < 0)
+        fatal(0, "invalid antialias '%s'", optarg);
+      break;
+    case 'i': FractalJobFactory::default_interior = true; break;
+    case 's': {
+      int s;
+      for(s = 0; s < strategy_limit; ++s)
+        if(!strcmp(strategy_names[s], optarg))
+          break;
+      if(s == strategy_limit)
+        fatal(0, "unknown strategy '%s'", optarg);
+      FractalJobFactory::default_strategy = render_strategy(s);
+      break;
+    }
     default: exit(1);
     }
   }
 
-  Job::init(nthreads);
+  Job::init(nthreads, placement);
 
   switch(mode) {
   case 'd':
@@ -81,7 +132,9 @@ int main(int argc, char **argv) {
          argv[optind + 3],
          argv[optind + 4],
          argv[optind + 5],
-         argv[optind + 6]);
+         argv[optind + 6],
+         statsPath,
+         antialias);
     return 0;
   case 'D':
     if(optind + 11 != argc)
@@ -99,13 +152,14 @@ int main(int argc, char **argv) {
                 argv[optind + 7],
                 argv[optind + 8],
                 argv[optind + 9],
-                argv[optind + 10]);
+                argv[optind + 10],
+                antialias);
   default: break;
   }
   if(optind != argc)
     fatal(0, "invalid argument '%s'", argv[optind]);
 
-  Glib::signal_timeout().connect(sigc::ptr_fun(periodic), 10);
+  Glib::signal_io().connect(sigc::ptr_fun(completions), Job::notifier(), Glib::IO_IN);
 
   mmui::mandelbrot = new mmui::MandelbrotWindow();
   mmui::julia = new mmui::JuliaWindow();
@@ -27,7 +27,9 @@ void draw(const char *wstr,
           const char *ystr,
           const char *rstr,
           const char *mistr,
-          const char *path) {
+          const char *path,
+          const char *statsPath,
+          int antialias) {
   arith_t x, y, radius;
   long width, height, maxiters;
   char *eptr;
@@ -80,16 +82,117 @@ void draw(const char *wstr,
   FILE *fp;
   if(!(fp = fopen(path, "wb")))
     fatal(errno, "opening %s", path);
-  if(draw(width, height, x, y, radius, maxiters, ARITH_DEFAULT, fp))
+  std::vector<TileStats> stats;
+  if(draw(width,
+          height,
+          x,
+          y,
+          radius,
+          maxiters,
+          ARITH_DEFAULT,
+          fp,
+          "png",
+          job_interactive,
+          statsPath ? &stats : nullptr,
+          nullptr,
+          0,
+          0,
+          0,
+          antialias))
     fatal(errno, "writing %s", path);
   if(fclose(fp) < 0)
     fatal(errno, "writing %s", path);
+
+  if(statsPath) {
+    if(!(fp = fopen(statsPath, "w")))
+      fatal(errno, "opening %s", statsPath);
+    if(writeTileStats(fp, stats) < 0)
+      fatal(errno, "writing %s", statsPath);
+    if(fclose(fp) < 0)
+      fatal(errno, "writing %s", statsPath);
+  }
+}
+
+// Where the draw() call in this thread collects statistics, if it does
+static thread_local std::vector<TileStats> *draw_stats;
+
+// Called in the thread that called draw(), unless it is also being polled
+// from the main loop (as in the GUI's movie renderer, which doesn't collect
+// statistics).
+static void completed(Job *job, void *) {
+  if(draw_stats)
+    draw_stats->push_back(TileStats(static_cast<FractalJob *>(job)));
+}
+
+// Pixels whose colour differs from a neighbour's by more than this in any
+// component get anti-aliased
+static const int antialias_threshold = 24;
+
+static inline void sample_color(count_t count, int maxiters, int &r, int &g, int &b) {
+  if(count < maxiters) {
+    r = red(count, maxiters);
+    g = green(count, maxiters);
+    b = blue(count, maxiters);
+  } else
+    r = g = b = 0;
+}
+
+// Colour of a pixel, averaged over any anti-aliasing passes
+static void pixel_color(
+    IterBuffer *dest, const std::vector<IterBuffer *> &passes, int px, int py, int maxiters, int &r, int &g, int &b) {
+  sample_color(dest->pixel(px, py), maxiters, r, g, b);
+  if(passes.empty())
+    return;
+  for(size_t n = 0; n < passes.size(); ++n) {
+    int pr, pg, pb;
+    sample_color(passes[n]->pixel(px, py), maxiters, pr, pg, pb);
+    r += pr;
+    g += pg;
+    b += pb;
+  }
+  const int samples = passes.size() + 1;
+  r = (r + samples / 2) / samples;
+  g = (g + samples / 2) / samples;
+  b = (b + samples / 2) / samples;
 }
 
-static void completed(Job *, void *) {
-  // do nothing
+// Pixels to anti-alias: those whose colour differs from a neighbour's.
+// (Escaped pixels within a pixel of the set, from the distance estimate, add
+// hardly any to these, and distances make the first pass much slower.)
+static std::vector<bool> antialias_edges(IterBuffer *dest, int maxiters) {
+  const int w = dest->width(), h = dest->height();
+  std::vector<int> colors(3 * w * h);
+  for(int py = 0; py < h; ++py)
+    for(int px = 0; px < w; ++px) {
+      int *c = &colors[3 * (py * w + px)];
+      sample_color(dest->pixel(px, py), maxiters, c[0], c[1], c[2]);
+    }
+  std::vector<bool> selected(w * h);
+  for(int py = 0; py < h; ++py)
+    for(int px = 0; px < w; ++px) {
+      const int *c = &colors[3 * (py * w + px)];
+      for(int ny = std::max(py - 1, 0); ny <= std::min(py + 1, h - 1); ++ny)
+        for(int nx = std::max(px - 1, 0); nx <= std::min(px + 1, w - 1); ++nx) {
+          const int *n = &colors[3 * (ny * w + nx)];
+          if(abs(c[0] - n[0]) > antialias_threshold || abs(c[1] - n[1]) > antialias_threshold
+             || abs(c[2] - n[2]) > antialias_threshold)
+            selected[py * w + px] = true;
+        }
+    }
+  return selected;
 }
 
+// If previous is not null then pixels are reused from *previous (if that is
+// not null either) as described for FractalJob::recompute, and on return it is
+// replaced with the new image, which the caller must eventually release.
+//
+// If antialias is more than 1 then pixels at edges get antialias x antialias
+// more samples (see FractalJob::supersample).
+//
+// Jobs come from factory if it is not null, so that a sequence of images can
+// share its job pool and tile timings.  Otherwise a default one is used.
+// Either way the jobs are keyed on the factory, since Job keeps an owner for
+// every completion_data value it has seen.
 int draw(int width,
          int height,
          arith_t x,
@@ -98,10 +201,65 @@ int draw(int width,
          int maxiters,
          arith_type arith,
          FILE *fp,
-         const char *fileType) {
-  MandelbrotJobFactory jf;
-  IterBuffer *dest = FractalJob::recompute(x, y, radius, maxiters, width, height, arith, completed, &jf, 0, 0, &jf);
-  Job::poll(&jf);
+         const char *fileType,
+         job_priority priority,
+         std::vector<TileStats> *stats,
+         IterBuffer **previous,
+         int px,
+         int py,
+         int zoom,
+         int antialias,
+         const FractalJobFactory *factory) {
+  if(!factory) {
+    static const MandelbrotJobFactory default_factory;
+    factory = &default_factory;
+  }
+  void *owner = const_cast<FractalJobFactory *>(factory);
+  draw_stats = stats;
+  IterBuffer *dest = FractalJob::recompute(x,
+                                           y,
+                                           radius,
+                                           maxiters,
+                                           width,
+                                           height,
+                                           arith,
+                                           completed,
+                                           owner,
+                                           0,
+                                           0,
+                                           factory,
+                                           priority,
+                                           1,
+                                           previous ? *previous : nullptr,
+                                           px,
+                                           py,
+                                           zoom);
+  Job::poll(owner);
+  // Statistics are only collected for the first pass
+  draw_stats = nullptr;
+  std::vector<IterBuffer *> passes;
+  if(antialias > 1) {
+    FractalJob::supersample(passes,
+                            dest,
+                            antialias_edges(dest, maxiters),
+                            antialias,
+                            x,
+                            y,
+                            radius,
+                            maxiters,
+                            arith,
+                            completed,
+                            owner,
+                            factory,
+                            priority);
+    Job::poll(owner);
+  }
+  if(previous) {
+    if(*previous)
+      (*previous)->release();
+    *previous = dest;
+    dest->acquire();
+  }
   // Write to a file
   if(!strcmp(fileType, "ppm")) {
     /* PPMs can be written directly */
@@ -110,16 +268,9 @@ int draw(int width,
       return -1;
     }
     for(int py = 0; py < height; ++py) {
-      const count_t *datarow = &dest->pixel(0, py);
       for(int px = 0; px < width; ++px) {
-        const count_t count = *datarow++;
         int r, g, b;
-        if(count < maxiters) {
-          r = red(count, maxiters);
-          g = green(count, maxiters);
-          b = blue(count, maxiters);
-        } else
-          r = g = b = 0;
+        pixel_color(dest, passes, px, py, maxiters, r, g, b);
         if(fprintf(fp, "%c%c%c", r, g, b) < 0) {
           perror("write error");
           return -1;
@@ -133,19 +284,13 @@ int draw(int width,
     const int rowstride = pixbuf->get_rowstride();
     guint8 *pixels = pixbuf->get_pixels();
     for(int py = 0; py < height; ++py) {
-      const count_t *datarow = &dest->pixel(0, py);
       guchar *pixelrow = pixels + py * rowstride;
       for(int px = 0; px < width; ++px) {
-        const count_t count = *datarow++;
-        if(count < maxiters) {
-          *pixelrow++ = red(count, maxiters);
-          *pixelrow++ = green(count, maxiters);
-          *pixelrow++ = blue(count, maxiters);
-        } else {
-          *pixelrow++ = 0;
-          *pixelrow++ = 0;
-          *pixelrow++ = 0;
-        }
+        int r, g, b;
+        pixel_color(dest, passes, px, py, maxiters, r, g, b);
+        *pixelrow++ = r;
+        *pixelrow++ = g;
+        *pixelrow++ = b;
       }
     }
     gchar *buffer;
@@ -159,6 +304,8 @@ int draw(int width,
     g_free(buffer);
   }
   dest->release();
+  for(size_t n = 0; n < passes.size(); ++n)
+    passes[n]->release();
   return 0;
 }
 
@@ -177,7 +324,8 @@ int dive(const char *wstr,
          const char *erstr,
          const char *mistr,
          const char *secstr,
-         const char *path) {
+         const char *path,
+         int antialias) {
   RenderMovie rm;
   char *eptr;
   int error;
@@ -256,13 +404,20 @@ int dive(const char *wstr,
   rm.codec = get_default("CODEC", "libx264");
   rm.fps = atoi(get_default("FRAME_RATE", "25").c_str());
   rm.bitrate = atoi(get_default("BITRATE", "2097152").c_str());
+  rm.octaves = atoi(get_default("OCTAVES", "0").c_str()) != 0;
   rm.path = path;
+  rm.antialias = antialias;
 
   return rm.Render();
 }
 
 int RenderMovie::Render(int *cancel) {
-  const int frames = seconds * fps;
+  int frames = seconds * fps;
+  if(octaves) {
+    frames = 1;
+    for(arith_t r = sr; r > er; r /= 2)
+      ++frames;
+  }
   double rk = pow((double)(er / sr), 1.0 / (frames - 1));
   std::stringstream command, pstream;
   // Construct the command
@@ -293,20 +448,60 @@ int RenderMovie::Render(int *cancel) {
   // TODO capture ffmpeg stderr and put it somewhere useful
   // (maybe the progress report should be a larger window)
   // Render PNGs to the pipe
+  IterBuffer *previous = nullptr;
+  arith_t x = sx, y = sy, radius = sr;
   for(int frame = 0; frame < frames && (!cancel || !ATOMIC_GET(*cancel)); ++frame) {
     std::stringstream pstream;
     pstream << "Frame " << frame << "/" << frames;
     Progress(pstream.str());
-    arith_t radius = sr * pow(rk, frame);
-    arith_t x = sx + arith_t(frame) * (ex - sx) / (frames - 1);
-    arith_t y = sy + arith_t(frame) * (ey - sy) / (frames - 1);
-    if(draw(width, height, x, y, radius, maxiters, arith, fp) < 0) {
+    int px = 0, py = 0, zoom = 0;
+    if(!octaves) {
+      radius = sr * pow(rk, frame);
+      x = sx + arith_t(frame) * (ex - sx) / (frames - 1);
+      y = sy + arith_t(frame) * (ey - sy) / (frames - 1);
+    } else if(frame) {
+      // Zoom in about the pixel nearest the end location
+      const arith_t pixel = FractalJob::pixel_size(radius, width, height);
+      const arith_t xleft = x - FractalJob::xradius(radius, width, height);
+      const arith_t ytop = y + FractalJob::yradius(radius, width, height);
+      px = std::min(std::max((int)floor((double)((ex - xleft) / pixel) + 0.5), 0), width - 1);
+      py = std::min(std::max((int)floor((double)((ytop - ey) / pixel) - 0.5), 0), height - 1);
+      if(FractalJob::zoom2(x, y, radius, width, height, px, py, 1))
+        zoom = 1;
+      else {
+        previous->release();
+        previous = nullptr;
+      }
+    }
+    // Frames are background work; interactive views take precedence.  They
+    // share draw()'s default factory, and so its job pool and tile timings.
+    if(draw(width,
+            height,
+            x,
+            y,
+            radius,
+            maxiters,
+            arith,
+            fp,
+            "png",
+            job_batch,
+            nullptr,
+            octaves ? &previous : nullptr,
+            px,
+            py,
+            zoom,
+            antialias)
+       < 0) {
       Progress("Encoding failed");
+      if(previous)
+        previous->release();
       pclose(fp);
       ::remove(path.c_str());
       return -1;
     }
   }
+  if(previous)
+    previous->release();
   // Finish
   int rc = pclose(fp);
   fprintf(stderr, "encoder: pclose: %d\n", rc);
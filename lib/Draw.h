@@ -16,6 +16,8 @@
 #ifndef DRAW_H
 #define DRAW_H
 
+#include "FractalJob.h"
+
 #ifndef DEFAULT_FFMPEG
 #define DEFAULT_FFMPEG "ffmpeg"
 #endif
@@ -26,7 +28,9 @@ void draw(const char *wstr,
           const char *ystr,
           const char *rstr,
           const char *mistr,
-          const char *path);
+          const char *path,
+          const char *statsPath = nullptr,
+          int antialias = 0);
 
 int dive(const char *wstr,
          const char *hstr,
@@ -38,7 +42,8 @@ int dive(const char *wstr,
          const char *erstr,
          const char *mistr,
          const char *secstr,
-         const char *path);
+         const char *path,
+         int antialias = 0);
 
 int draw(int width,
          int height,
@@ -48,7 +53,15 @@ int draw(int width,
          int maxiters,
          arith_type arith,
          FILE *fp,
-         const char *fileType = "png");
+         const char *fileType = "png",
+         job_priority priority = job_interactive,
+         std::vector<TileStats> *stats = nullptr,
+         IterBuffer **previous = nullptr,
+         int px = 0,
+         int py = 0,
+         int zoom = 0,
+         int antialias = 0,
+         const FractalJobFactory *factory = nullptr);
 
 class RenderMovie {
 public:
@@ -68,6 +81,11 @@ public:
   std::string ffmpeg = DEFAULT_FFMPEG;
   std::string codec = "libx264";
   std::string path = "mandy.mp4";
+  // Zoom in by exactly 2 per frame, reusing a quarter of each frame's
+  // pixels, until the radius reaches er.  seconds is ignored.
+  bool octaves = false;
+  // Anti-alias edges with this many samples per axis, if more than 1
+  int antialias = 0;
 
   int Render(int *cancel = nullptr);
 
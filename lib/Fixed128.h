@@ -162,8 +162,12 @@ long double Fixed128_2longdouble(const union Fixed128 *a);
 void Fixed256_to_Fixed128(union Fixed128 *r, union Fixed256 *a);
 void Fixed128_to_Fixed256(union Fixed256 *r, union Fixed128 *a);
 
-int Fixed128_iterate(
-    union Fixed128 *zx, union Fixed128 *zy, const union Fixed128 *cx, const union Fixed128 *cy, int64_t maxiters);
+int Fixed128_iterate(union Fixed128 *zx,
+                     union Fixed128 *zy,
+                     const union Fixed128 *cx,
+                     const union Fixed128 *cy,
+                     int64_t maxiters,
+                     const int *cancel);
 
 #ifdef __cplusplus
 }
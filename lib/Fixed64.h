@@ -90,7 +90,7 @@ void Fixed64_to_Fixed128(union Fixed128 *r, Fixed64 a);
 
 void Fixed256_to_Fixed64(Fixed64 *r, union Fixed256 *a);
 
-int Fixed64_iterate(Fixed64 zx, Fixed64 zy, Fixed64 cx, Fixed64 cy, double *r2p, int maxiters);
+int Fixed64_iterate(Fixed64 zx, Fixed64 zy, Fixed64 cx, Fixed64 cy, double *r2p, int maxiters, const int *cancel);
 
 #ifdef __cplusplus
 }
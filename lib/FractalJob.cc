@@ -15,9 +15,11 @@
  */
 #include "mandy.h"
 #include "FractalJob.h"
+#include "ReferenceOrbit.h"
 #include <algorithm>
+#include <climits>
 #include <cstring>
-#include "PixelStream.h"
+#include <ctime>
 
 struct comparator {
   int cx, cy;
@@ -31,6 +33,115 @@ struct comparator {
   }
 };
 
+// If origin + i * pixel = -(origin + j * pixel) whenever i + j = k, for some
+// integer k, return k.  A tiny fraction of a pixel out is close enough, since
+// rounding in the pixel size would be that far out anyway.  Returns -1 if
+// there is no such k.
+static int mirror_sum(const arith_t &origin, const arith_t &pixel) {
+  const double s = (double)(-(origin * 2) / pixel);
+  if(!(s >= 0 && s < INT_MAX / 2))
+    return -1;
+  const int k = (int)floor(s + 0.5);
+  arith_t error = origin * 2 + arith_t(k) * pixel;
+  if(error < arith_t(0))
+    error = -error;
+  return error < pixel / 65536 / 65536 ? k : -1;
+}
+
+// Split [0, limit) into pieces no bigger than size, not crossing skip_lo or
+// skip_hi.  Each piece is appended to pieces as a start and a size.
+static void tile_edges(std::vector<int> &pieces, int limit, int size, int skip_lo, int skip_hi) {
+  const int edges[] = {0, skip_lo, skip_hi, limit};
+  pieces.clear();
+  for(int n = 0; n < 3; ++n)
+    for(int p = edges[n]; p < edges[n + 1]; p += size) {
+      pieces.push_back(p);
+      pieces.push_back(std::min(size, edges[n + 1] - p));
+    }
+}
+
+// Computes the reference orbit for arith_perturbation and then submits the
+// tiles that use it.  The orbit can take as long as a whole image at
+// ordinary precision, so it's done in the background, and is cancelled along
+// with the tiles.
+class ReferenceJob: public Job {
+public:
+  arith_t cx, cy, r;
+  int maxiters;
+  const FractalJobFactory *factory;
+  std::vector<FractalJob *> tiles; // submitted in this order
+  void (*tile_callback)(Job *, void *);
+  job_priority priority;
+
+  ~ReferenceJob() {
+    // Tiles are left over if the job was cancelled
+    for(size_t n = 0; n < tiles.size(); ++n) {
+      ATOMIC_SET(tiles[n]->cancelled);
+      tiles[n]->recycle();
+    }
+  }
+
+  void work() override {
+    ReferenceOrbit *reference = factory->reference_orbit(cx, cy, maxiters, &cancelled);
+    if(ATOMIC_LOAD(cancelled)) {
+      if(reference)
+        reference->release();
+      return;
+    }
+    if(reference)
+      factory->keep_reference(reference, r);
+    for(size_t n = 0; n < tiles.size(); ++n) {
+      tiles[n]->reference = reference ? reference->acquire() : nullptr;
+      spawn(tiles[n], tile_callback, priority);
+    }
+    tiles.clear();
+    if(reference)
+      reference->release();
+  }
+};
+
+// Tiles are all that the caller sees
+static void reference_completed(Job *, void *) {}
+
+// Submit tiles for a w x h view, in order.  For arith_perturbation they need
+// a reference orbit, so unless the factory has kept a suitable one they are
+// left to a ReferenceJob to submit.
+static void submit_tiles(std::vector<FractalJob *> &tiles,
+                         arith_t cx,
+                         arith_t cy,
+                         arith_t r,
+                         int w,
+                         int h,
+                         int maxiters,
+                         arith_type arith,
+                         void (*completion_callback)(Job *, void *),
+                         void *completion_data,
+                         const FractalJobFactory *factory,
+                         job_priority priority) {
+  if(arith == arith_perturbation) {
+    ReferenceOrbit *reference = factory->kept_reference(cx, cy, r, w, h, maxiters);
+    if(!reference) {
+      ReferenceJob *rj = new ReferenceJob();
+      rj->cx = cx;
+      rj->cy = cy;
+      rj->r = r;
+      rj->maxiters = maxiters;
+      rj->factory = factory;
+      rj->tiles.swap(tiles);
+      rj->tile_callback = completion_callback;
+      rj->priority = priority;
+      rj->submit(reference_completed, completion_data, priority);
+      return;
+    }
+    for(size_t n = 0; n < tiles.size(); ++n)
+      tiles[n]->reference = reference->acquire();
+    reference->release();
+  }
+  for(size_t n = 0; n < tiles.size(); ++n)
+    tiles[n]->submit(completion_callback, completion_data, priority);
+  tiles.clear();
+}
+
 IterBuffer *FractalJob::recompute(arith_t cx,
                                   arith_t cy,
                                   arith_t r,
@@ -42,94 +153,624 @@ IterBuffer *FractalJob::recompute(arith_t cx,
                                   void *completion_data,
                                   int xpos,
                                   int ypos,
-                                  const FractalJobFactory *factory) {
-  IterBuffer *dest = new IterBuffer(w, h);
-  // Set everything to 'unknown'
-  dest->clear();
-  // Chunks need to be large enough that the overhead of jobs doesn't
-  // add up to much but small enough that stale jobs don't hog the CPU
-  // much.
-  //
-  // Chunk widths should normally be powers of 2, so that SIMD implementations
-  // don't waste columns.
-  const int chunk = 32;
-  std::vector<FractalJob *> jobs;
-  for(int px = 0; px < dest->width(); px += chunk) {
-    const int pw = std::min(chunk, dest->width() - px);
-    for(int py = 0; py < dest->height(); py += chunk) {
-      const int ph = std::min(chunk, dest->height() - py);
-      FractalJob *j = factory->create();
-      j->set(dest, cx, cy, r, maxiters, px, py, pw, ph, arith);
-      jobs.push_back(j);
+                                  const FractalJobFactory *factory,
+                                  job_priority priority,
+                                  int preview,
+                                  IterBuffer *previous,
+                                  int dx,
+                                  int dy,
+                                  int zoom) {
+  // Set everything to 'unknown'.  If workers are placed on particular CPUs,
+  // each job does its own tile instead, so that the memory ends up near the
+  // CPU that computes it.  That's not possible with previews or reused
+  // pixels, since the jobs must not wipe them out.
+  const bool first_touch = Job::placement() != placement_none && preview <= 1 && !previous;
+  if(arith == arith_auto)
+    arith = choose_arith((double)pixel_size(r, w, h));
+  IterBuffer *dest = new IterBuffer(w, h, !first_touch, factory->distances);
+  const bool reused = previous && dest->copy(previous, dx, dy, zoom);
+  // Find the part of the image that's a copy of another part.  Reused pixels
+  // would have to be copied in advance, so symmetry is only used for fresh
+  // images.
+  int mirror_x = -1, mirror_y = -1;
+  int skip_x = 0, skip_y = 0, skip_w = 0, skip_h = 0;
+  const fractal_symmetry symmetry = reused ? symmetry_none : factory->symmetry();
+  if(symmetry != symmetry_none) {
+    const arith_t pixel = pixel_size(r, w, h);
+    const int sy = mirror_sum(cy - yradius(r, w, h), pixel);
+    // Rows are numbered downwards
+    if(sy >= 0 && sy <= 2 * (h - 1)) {
+      mirror_y = 2 * (h - 1) - sy;
+      // Skip the smaller side of the axis
+      if(mirror_y < h) {
+        skip_y = 0;
+        skip_h = (mirror_y + 1) / 2;
+      } else {
+        skip_y = mirror_y / 2 + 1;
+        skip_h = h - skip_y;
+      }
+      skip_w = w;
+    }
+    if(symmetry == symmetry_rotation) {
+      mirror_x = mirror_sum(cx - xradius(r, w, h), pixel);
+      if(mirror_x < 0 || mirror_x > 2 * (w - 1))
+        skip_w = 0;
+      else {
+        skip_x = std::max(mirror_x - (w - 1), 0);
+        skip_w = std::min(mirror_x, w - 1) + 1 - skip_x;
+      }
     }
+    if(!skip_w || !skip_h)
+      mirror_x = mirror_y = -1;
   }
-  comparator c(xpos, ypos);
-  std::sort(jobs.begin(), jobs.end(), c);
-  for(size_t n = 0; n < jobs.size(); ++n)
-    jobs[n]->submit(completion_callback, completion_data);
+  const int chunk = factory->tile_size(w, h, maxiters, arith);
+  std::vector<FractalJob *> jobs, tiles;
+  std::vector<int> columns, rows;
+  // Preview tiles cover step times as many pixels in each direction, so that
+  // they compute about as many pixels as a full tile.  The preview pass is
+  // submitted in full before the full pass, and ignores symmetry.
+  for(int step = std::max(preview, 1);; step = 1) {
+    const int size = chunk * step;
+    const bool symmetric = step == 1 && mirror_y >= 0;
+    if(symmetric) {
+      // Tiles are either entirely inside the skipped part or entirely outside
+      tile_edges(columns, w, size, skip_x, skip_x + skip_w);
+      tile_edges(rows, h, size, skip_y, skip_y + skip_h);
+    } else {
+      tile_edges(columns, w, size, 0, 0);
+      tile_edges(rows, h, size, 0, 0);
+    }
+    jobs.clear();
+    for(size_t c = 0; c < columns.size(); c += 2) {
+      const int px = columns[c], pw = columns[c + 1];
+      for(size_t n = 0; n < rows.size(); n += 2) {
+        const int py = rows[n], ph = rows[n + 1];
+        if(reused && dest->computed(px, py, pw, ph))
+          continue;
+        if(symmetric && px >= skip_x && px < skip_x + skip_w && py >= skip_y && py < skip_y + skip_h)
+          continue;
+        FractalJob *j = factory->get();
+        j->set(dest, cx, cy, r, maxiters, px, py, pw, ph, arith);
+        j->step = step;
+        j->sample = -1;
+        j->first_touch = first_touch;
+        if(symmetric) {
+          j->mirror_x = mirror_x;
+          j->mirror_y = mirror_y;
+          j->skip_x = skip_x;
+          j->skip_y = skip_y;
+          j->skip_w = skip_w;
+          j->skip_h = skip_h;
+        } else {
+          j->mirror_x = j->mirror_y = -1;
+          j->skip_w = j->skip_h = 0;
+        }
+        jobs.push_back(j);
+      }
+    }
+    comparator c(xpos, ypos);
+    std::sort(jobs.begin(), jobs.end(), c);
+    tiles.insert(tiles.end(), jobs.begin(), jobs.end());
+    if(step == 1)
+      break;
+  }
+  submit_tiles(tiles, cx, cy, r, w, h, maxiters, arith, completion_callback, completion_data, factory, priority);
   return dest;
 }
 
-void FractalJob::work() {
-  switch(arith) {
-#if SIMD
-  case arith_simd: simd_work(); break;
-#endif
-  default: sisd_work(); break;
+void FractalJob::supersample(std::vector<IterBuffer *> &passes,
+                             IterBuffer *image,
+                             const std::vector<bool> &selected,
+                             int grid,
+                             arith_t cx,
+                             arith_t cy,
+                             arith_t r,
+                             int maxiters,
+                             arith_type arith,
+                             void (*completion_callback)(Job *, void *),
+                             void *completion_data,
+                             const FractalJobFactory *factory,
+                             job_priority priority) {
+  const int w = image->width(), h = image->height();
+  if(arith == arith_auto)
+    arith = choose_arith((double)pixel_size(r, w, h));
+  const int chunk = factory->tile_size(w, h, maxiters, arith);
+  std::vector<FractalJob *> tiles;
+  for(int sample = 0; sample < grid * grid; ++sample) {
+    IterBuffer *dest = new IterBuffer(w, h);
+    for(int py = 0; py < h; ++py)
+      for(int px = 0; px < w; ++px)
+        if(!selected[py * w + px])
+          dest->pixel(px, py) = image->pixel(px, py);
+    passes.push_back(dest);
+    // Only tiles with selected pixels get jobs
+    for(int py = 0; py < h; py += chunk)
+      for(int px = 0; px < w; px += chunk) {
+        const int pw = std::min(chunk, w - px), ph = std::min(chunk, h - py);
+        if(dest->computed(px, py, pw, ph))
+          continue;
+        FractalJob *j = factory->get();
+        j->set(dest, cx, cy, r, maxiters, px, py, pw, ph, arith);
+        j->step = 1;
+        j->sample = sample;
+        j->grid = grid;
+        j->first_touch = false;
+        j->mirror_x = j->mirror_y = -1;
+        j->skip_w = j->skip_h = 0;
+        tiles.push_back(j);
+      }
   }
+  submit_tiles(tiles, cx, cy, r, w, h, maxiters, arith, completion_callback, completion_data, factory, priority);
 }
 
-void FractalJob::sisd_work() {
-  int px, py, d;
-  bool escaped = false;
-  if(w > 2 && h > 2) {
-    PixelStreamEdge edge_pixels(x, y, w, h);
-    while(edge_pixels.next(px, py))
-      escaped |= sisd_calculate(px, py);
-    d = 1;
+void FractalJob::work() {
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  if(first_touch)
+    dest->clear(x, y, w, h);
+  coordinates();
+  skip = reference ? reference->skippable(column_x.front(), row_y.back(), column_x.back(), row_y.front()) : 0;
+  bool complete;
+  if(step > 1) {
+    PixelStreamGrid grid(x, y, w, h, step);
+    complete = calculate(grid);
+  } else if(dest->has_distances() || sample >= 0) {
+    // Every pixel needs computing, or none of the filled ones would be right
+    PixelStreamRectangle all(x, y, w, h);
+    complete = calculate(all);
+  } else if(factory->strategy == strategy_trace) {
+    complete = trace();
+  } else if(w > 2 && h > 2) {
+    PixelStreamEdge border(x, y, w, h);
+    complete = calculate(border) && subdivide(x, y, w, h);
   } else {
-    escaped = true;
-    d = 0;
+    PixelStreamRectangle all(x, y, w, h);
+    complete = calculate(all);
   }
-  PixelStreamRectangle fill_pixels(x + d, y + d, w - d, h - d);
-  if(escaped) {
-    while(fill_pixels.next(px, py))
-      sisd_calculate(px, py);
+  if(complete)
+    mirror();
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  elapsed = finished.tv_sec - started.tv_sec + (finished.tv_nsec - started.tv_nsec) / 1000000000.0;
+  done = complete;
+}
+
+bool FractalJob::zoom2(arith_t &cx, arith_t &cy, arith_t &radius, int w, int h, int px, int py, int zoom) {
+  const arith_t pixel = pixel_size(radius, w, h);
+  const arith_t xleft = cx - xradius(radius, w, h), ybottom = cy - yradius(radius, w, h);
+  arith_t newpixel, newxleft, newybottom;
+  bool exact = true;
+  // Column px and row py have the same coordinates before and after
+  if(zoom > 0) {
+    newpixel = pixel / 2;
+    if(newpixel * 2 != pixel) {
+      exact = false;
+      // Round the pixel size down to a multiple of 2^32 units in the last
+      // place, so that the next 32 zooms can be exact.  Don't bother near the
+      // limit of precision, where that would change it noticeably.
+      const arith_t rounded = newpixel / 65536 / 65536 * 65536 * 65536;
+      if((newpixel - rounded) * 1048576 < newpixel)
+        newpixel = rounded;
+    }
+    newxleft = xleft + arith_t(px) * newpixel;
+    newybottom = ybottom + arith_t(h - 1 - py) * newpixel;
   } else {
-    while(fill_pixels.next(px, py))
-      dest->pixel(px, py) = transform_iterations(maxiters, 0, maxiters);
+    newpixel = pixel * 2;
+    newxleft = xleft - arith_t(px) * pixel;
+    newybottom = ybottom - arith_t(h - 1 - py) * pixel;
   }
+  // image_xsize() multiplies the radius by an integer and then divides by
+  // the same integer, so this radius gives exactly the new pixel size unless
+  // there's rounding along the way.
+  radius = (w > h ? newpixel * h : newpixel * w) / 2;
+  cx = newxleft + xradius(radius, w, h);
+  cy = newybottom + yradius(radius, w, h);
+  return exact && pixel_size(radius, w, h) == newpixel;
 }
 
-#if SIMD
-void FractalJob::simd_work() {
-  int px[SIMD], py[SIMD], d;
-  bool escaped = false;
-  if(w > 2 && h > 2) {
-    PixelStreamEdge edge_pixels(x, y, w, h);
-    while(edge_pixels.morepixels(SIMD, px, py))
-      escaped |= simd_calculate(px, py);
-    d = 1;
-  } else {
-    escaped = true;
-    d = 0;
+bool FractalJob::mirrored(int &mx, int &my, int &mw, int &mh) const {
+  if(mirror_y < 0)
+    return false;
+  const int x0 = mirror_x >= 0 ? mirror_x - (x + w - 1) : x;
+  const int y0 = mirror_y - (y + h - 1);
+  mx = std::max(x0, skip_x);
+  my = std::max(y0, skip_y);
+  mw = std::min(x0 + w, skip_x + skip_w) - mx;
+  mh = std::min(y0 + h, skip_y + skip_h) - my;
+  return mw > 0 && mh > 0;
+}
+
+void FractalJob::mirror() {
+  int mx, my, mw, mh;
+  if(!mirrored(mx, my, mw, mh))
+    return;
+  for(int py = my; py < my + mh; ++py) {
+    const int sy = mirror_y - py;
+    for(int px = mx; px < mx + mw; ++px) {
+      const int sx = mirror_x >= 0 ? mirror_x - px : px;
+      dest->pixel(px, py) = dest->pixel(sx, sy);
+      if(dest->has_distances())
+        dest->distance(px, py) = dest->distance(sx, sy);
+    }
   }
-  PixelStreamRectangle fill_pixels(x + d, y + d, w - d, h - d);
-  if(escaped) {
-    while(fill_pixels.morepixels(SIMD, px, py))
-      simd_calculate(px, py);
-  } else {
-    while(fill_pixels.morepixels(SIMD, px, py))
-      for(int i = 0; i < SIMD; i++)
-        dest->pixel(px[i], py[i]) = transform_iterations(maxiters, 0, maxiters);
+}
+
+int writeTileStats(FILE *fp, const std::vector<TileStats> &tiles) {
+  if(fprintf(fp, "x,y,w,h,seconds,iterations,evaluated,arith\n") < 0)
+    return -1;
+  for(size_t n = 0; n < tiles.size(); ++n) {
+    const TileStats &t = tiles[n];
+    if(fprintf(fp,
+               "%d,%d,%d,%d,%.9f,%.0f,%d,%s\n",
+               t.x,
+               t.y,
+               t.w,
+               t.h,
+               t.elapsed,
+               (double)t.iterations,
+               t.evaluated,
+               arith_names[t.arith])
+       < 0)
+      return -1;
   }
+  return 0;
+}
+
+// Offset in pixels of an anti-aliasing sample from the pixel's center, on
+// one axis, for row or column n.  The sample is in the given cell of the
+// pixel's grid divisions, at a pseudo-random point within it, so that the
+// samples of a pixel are evenly spread and neighbouring pixels' are
+// unrelated.  salt distinguishes samples and axes.
+static double jitter(int n, int salt, int cell, int grid) {
+  uint32_t hash = (uint32_t)n * 0x9E3779B1u ^ (uint32_t)salt * 0x85EBCA77u;
+  hash ^= hash >> 15;
+  hash *= 0x2C1B3C6Du;
+  hash ^= hash >> 12;
+  hash *= 0x297A2D39u;
+  hash ^= hash >> 15;
+  return (cell + (hash >> 8) / 16777216.0) / grid - 0.5;
 }
+
+// One division per tile, then successive additions.  Since fixed-point
+// addition is exact, this gives the same answer as multiplying each pixel
+// position by the (rounded) pixel size, which is within a few ulps of
+// dividing per pixel.
+void FractalJob::coordinates() {
+  const arith_t pixel = xsize / dest->width();
+  column_x.resize(w);
+  row_y.resize(h);
+  column_x[0] = xleft + arith_t(x) * pixel;
+  for(int i = 1; i < w; ++i)
+    column_x[i] = column_x[i - 1] + pixel;
+  row_y[0] = ybottom + arith_t(dest->height() - 1 - y) * pixel;
+  for(int j = 1; j < h; ++j)
+    row_y[j] = row_y[j - 1] - pixel;
+  if(sample >= 0) {
+    for(int i = 0; i < w; ++i)
+      column_x[i] += pixel * arith_t(jitter(x + i, 2 * sample, sample % grid, grid));
+    for(int j = 0; j < h; ++j)
+      row_y[j] -= pixel * arith_t(jitter(y + j, 2 * sample + 1, sample / grid, grid));
+  }
+#if SIMD
+  column_xd.resize(w);
+  row_yd.resize(h);
+  for(int i = 0; i < w; ++i)
+    column_xd[i] = (double)column_x[i];
+  for(int j = 0; j < h; ++j)
+    row_yd[j] = (double)row_y[j];
 #endif
+}
+
+bool FractalJob::abandon() {
+  if(!ATOMIC_LOAD(cancelled))
+    return false;
+  dest->clear(x, y, w, h);
+  return true;
+}
+
+bool FractalJob::calculate(PixelStream &pixels) {
+#if SIMD
+  if(arith == arith_simd || (arith == arith_perturbation && reference)) {
+    int px[SIMD], py[SIMD];
+    for(;;) {
+      int n = 0;
+      while(n < SIMD && pixels.next(px[n], py[n]))
+        if(!known(px[n], py[n]))
+          ++n;
+      if(!n)
+        return true;
+      // Pad with repeats of a pixel from this batch
+      for(int i = n; i < SIMD; ++i) {
+        px[i] = px[0];
+        py[i] = py[0];
+      }
+      simd_calculate(px, py);
+      evaluated += n;
+      if(abandon())
+        return false;
+    }
+  }
+#endif
+  int px, py;
+  while(pixels.next(px, py)) {
+    if(known(px, py))
+      continue;
+    sisd_calculate(px, py);
+    ++evaluated;
+    if(abandon())
+      return false;
+  }
+  return true;
+}
+
+// Mariani-Silver subdivision.  The sets are simply connected, so if the
+// border of a rectangle is entirely inside, so is everything within it.
+// Escaped points have smoothed counts, so in practice only such interior
+// rectangles are uniform.
+bool FractalJob::subdivide(int rx, int ry, int rw, int rh) {
+  if(rw <= 2 || rh <= 2)
+    return true; // no inside
+  if(uniform(rx, ry, rw, rh)) {
+    const count_t value = dest->pixel(rx, ry);
+    for(int py = ry + 1; py < ry + rh - 1; ++py)
+      for(int px = rx + 1; px < rx + rw - 1; ++px)
+        dest->pixel(px, py) = value;
+    return true;
+  }
+  if(rw <= min_subdivide || rh <= min_subdivide) {
+    PixelStreamRectangle inside(rx + 1, ry + 1, rw - 2, rh - 2);
+    return calculate(inside);
+  }
+  // Compute a cross through the middle, which completes the borders of the
+  // four quarters
+  const int mx = rx + rw / 2, my = ry + rh / 2;
+  PixelStreamRectangle across(rx + 1, my, rw - 2, 1);
+  PixelStreamRectangle up(mx, ry + 1, 1, my - ry - 1);
+  PixelStreamRectangle down(mx, my + 1, 1, ry + rh - my - 2);
+  if(!calculate(across) || !calculate(up) || !calculate(down))
+    return false;
+  return subdivide(rx, ry, mx - rx + 1, my - ry + 1) && subdivide(mx, ry, rx + rw - mx, my - ry + 1)
+         && subdivide(rx, my, mx - rx + 1, ry + rh - my) && subdivide(mx, my, rx + rw - mx, ry + rh - my);
+}
+
+bool FractalJob::uniform(int rx, int ry, int rw, int rh) {
+  PixelStreamEdge border(rx, ry, rw, rh);
+  int px, py;
+  border.next(px, py);
+  const count_t value = dest->pixel(px, py);
+  while(border.next(px, py))
+    if(dest->pixel(px, py) != value)
+      return false;
+  return true;
+}
+
+// Boundary tracing.  Starting from the edge of the tile, any pixel whose
+// neighbour has a different value is on a boundary, so its neighbours are
+// computed too.  This follows the boundaries of every region of equal value,
+// without entering them.  Anything left uncomputed at the end is enclosed by
+// a boundary of a single value, and is filled from the left.
+//
+// Escaped pixels have smoothed counts, so all escaped regions are explored
+// in full; only the interior of the set is skipped.  Pixels are computed in
+// waves, so that the SIMD path gets whole batches.
+bool FractalJob::trace() {
+  enum {
+    computed = 1, // pixel has been computed
+    queued = 2,   // pixel has been queued for checking
+  };
+  traced.assign(w * h, 0);
+  trace_queue.clear();
+  for(int i = 0; i < w; ++i) {
+    trace_queue.push_back(i);
+    if(h > 1)
+      trace_queue.push_back((h - 1) * w + i);
+  }
+  for(int j = 1; j < h - 1; ++j) {
+    trace_queue.push_back(j * w);
+    if(w > 1)
+      trace_queue.push_back(j * w + w - 1);
+  }
+  for(size_t n = 0; n < trace_queue.size(); ++n)
+    traced[trace_queue[n]] = queued;
+  size_t head = 0;
+  while(head < trace_queue.size()) {
+    const size_t end = trace_queue.size();
+    // Compute the queued pixels and all their neighbours
+    trace_todo.clear();
+    for(size_t n = head; n < end; ++n) {
+      const int i = trace_queue[n] % w, j = trace_queue[n] / w;
+      for(int nj = std::max(j - 1, 0); nj <= std::min(j + 1, h - 1); ++nj)
+        for(int ni = std::max(i - 1, 0); ni <= std::min(i + 1, w - 1); ++ni)
+          if(!(traced[nj * w + ni] & computed)) {
+            traced[nj * w + ni] |= computed;
+            trace_todo.push_back(nj * w + ni);
+          }
+    }
+    PixelStreamList todo(trace_todo, x, y, w);
+    if(!calculate(todo))
+      return false;
+    // Queue neighbours across a boundary
+    for(size_t n = head; n < end; ++n) {
+      const int i = trace_queue[n] % w, j = trace_queue[n] / w;
+      const count_t value = dest->pixel(x + i, y + j);
+      for(int nj = std::max(j - 1, 0); nj <= std::min(j + 1, h - 1); ++nj)
+        for(int ni = std::max(i - 1, 0); ni <= std::min(i + 1, w - 1); ++ni)
+          if(!(traced[nj * w + ni] & queued) && dest->pixel(x + ni, y + nj) != value) {
+            traced[nj * w + ni] |= queued;
+            trace_queue.push_back(nj * w + ni);
+          }
+    }
+    head = end;
+  }
+  // The left column is on the edge, so always computed
+  for(int j = 0; j < h; ++j)
+    for(int i = 1; i < w; ++i)
+      if(!(traced[j * w + i] & computed))
+        dest->pixel(x + i, y + j) = dest->pixel(x + i - 1, y + j);
+  return true;
+}
 
 bool FractalJob::fastpath(arith_t, arith_t, int &, double &) {
   return false;
 }
 
+FractalJob::~FractalJob() {
+  if(dest)
+    dest->release();
+  if(reference)
+    reference->release();
+}
+
+void FractalJob::recycle() {
+  if(dest) {
+    dest->release();
+    dest = nullptr;
+  }
+  if(reference) {
+    reference->release();
+    reference = nullptr;
+  }
+  // Anti-aliasing tiles only compute a few of their pixels, and cancelled
+  // tiles may have computed none, so their timings would mislead tile_size()
+  if(done && step == 1 && sample < 0)
+    factory->record(this);
+  cancelled = 0;
+  factory->put(this);
+}
+
+bool FractalJobFactory::default_interior = false;
+
+const char *const strategy_names[] = {
+    "subdivide",
+    "trace",
+};
+
+render_strategy FractalJobFactory::default_strategy = strategy_subdivide;
+
+FractalJobFactory::FractalJobFactory(): pool_lock(LockCreate()) {}
+
+FractalJobFactory::~FractalJobFactory() {
+  for(size_t n = 0; n < pool.size(); ++n)
+    delete pool[n];
+  if(kept)
+    kept->release();
+  LockDestroy(pool_lock);
+}
+
+FractalJob *FractalJobFactory::get() const {
+  FractalJob *j = nullptr;
+  LockAcquire(pool_lock);
+  if(pool.size()) {
+    j = pool.back();
+    pool.pop_back();
+    ++nreused;
+  } else
+    ++nallocated;
+  LockRelease(pool_lock);
+  if(j)
+    reuse(j);
+  else {
+    j = create();
+    j->factory = this;
+  }
+  return j;
+}
+
+void FractalJobFactory::put(FractalJob *j) const {
+  LockAcquire(pool_lock);
+  if(pool.size() < max_pool) {
+    pool.push_back(j);
+    j = nullptr;
+  }
+  LockRelease(pool_lock);
+  delete j;
+}
+
+void FractalJobFactory::reuse(FractalJob *) const {}
+
+fractal_symmetry FractalJobFactory::symmetry() const {
+  return symmetry_none;
+}
+
+ReferenceOrbit *FractalJobFactory::reference_orbit(arith_t, arith_t, int, const int *) const {
+  return nullptr;
+}
+
+bool FractalJobFactory::reference_matches(const ReferenceOrbit *) const {
+  return true;
+}
+
+// Perturbation works from any reference in view, but only a pan is reused,
+// so that a zoom gets a reference at its new center.
+ReferenceOrbit *FractalJobFactory::kept_reference(arith_t cx, arith_t cy, arith_t r, int w, int h, int maxiters) const {
+  ReferenceOrbit *reference = nullptr;
+  LockAcquire(pool_lock);
+  if(kept && kept->maxiters == maxiters && kept_radius == r && reference_matches(kept)) {
+    arith_t dx = (kept->vary_z ? kept->zx0 : kept->cx) - cx, dy = (kept->vary_z ? kept->zy0 : kept->cy) - cy;
+    if(dx < arith_t(0))
+      dx = -dx;
+    if(dy < arith_t(0))
+      dy = -dy;
+    if(dx <= FractalJob::xradius(r, w, h) && dy <= FractalJob::yradius(r, w, h))
+      reference = kept->acquire();
+  }
+  LockRelease(pool_lock);
+  return reference;
+}
+
+void FractalJobFactory::keep_reference(ReferenceOrbit *reference, arith_t r) const {
+  reference->acquire();
+  LockAcquire(pool_lock);
+  std::swap(kept, reference);
+  kept_radius = r;
+  LockRelease(pool_lock);
+  if(reference)
+    reference->release();
+}
+
+void FractalJobFactory::record(const FractalJob *j) const {
+  LockAcquire(pool_lock);
+  if(j->maxiters != timed_maxiters || j->arith != timed_arith) {
+    timed_seconds = timed_pixels = 0;
+    timed_maxiters = j->maxiters;
+    timed_arith = j->arith;
+  }
+  timed_seconds += j->elapsed;
+  timed_pixels += j->w * j->h;
+  LockRelease(pool_lock);
+}
+
+// Tiles need to be large enough that the overhead of jobs doesn't add up to
+// much but small enough that stale jobs don't hog the CPU much, and that the
+// last few tiles of an image don't leave threads idle for long.  The cost per
+// pixel is estimated from the previous image, scaled by maxiters (which is
+// pessimistic for escaped pixels) and by the cost of the arithmetic type.
+// For the first image it is maxiters iterations of that type.
+//
+// Tile widths should normally be powers of 2, so that SIMD implementations
+// don't waste columns.
+int FractalJobFactory::tile_size(int w, int h, int maxiters, arith_type arith) const {
+  LockAcquire(pool_lock);
+  if(timed_pixels > 0) {
+    pixel_seconds = timed_seconds / timed_pixels;
+    pixel_maxiters = timed_maxiters;
+    pixel_arith = timed_arith;
+    timed_seconds = timed_pixels = 0;
+  }
+  double estimate;
+  if(pixel_seconds > 0)
+    estimate = pixel_seconds * maxiters / pixel_maxiters * arith_cost(arith) / arith_cost(pixel_arith);
+  else
+    estimate = maxiters * arith_cost(arith);
+  LockRelease(pool_lock);
+  int tile = min_tile;
+  while(tile < max_tile && 4.0 * tile * tile * estimate <= tile_target)
+    tile *= 2;
+  const int threads = std::max(Job::threads(), 1);
+  while(tile > min_tile && ((w - 1) / tile + 1) * ((h - 1) / tile + 1) < 4 * threads)
+    tile /= 2;
+  return tile;
+}
+
 /*
 Local Variables:
 mode:c++
@@ -19,24 +19,69 @@
 #include "Job.h"
 #include "arith.h"
 #include "simdarith.h"
+#include "PixelStream.h"
+#include <cstdio>
 
 class FractalJobFactory;
+class ReferenceOrbit;
+
+// Symmetries that a fractal can have
+enum fractal_symmetry {
+  symmetry_none,
+  symmetry_conjugate, // mirrored in the real axis
+  symmetry_rotation,  // unchanged by rotating 180 degrees about 0
+};
+
+// How a tile is computed
+enum render_strategy {
+  strategy_subdivide, // Mariani-Silver subdivision
+  strategy_trace,     // boundary tracing
+  strategy_limit,
+};
+
+extern const char *const strategy_names[];
 
 class FractalJob: public Job {
 public:
   IterBuffer *dest = nullptr; // buffer to store results in
   arith_t xleft, ybottom;     // complex-plane location
   arith_t xsize;              // complex-plane size
+  double pixel_scale;         // pixels per unit of complex plane
   int maxiters;               // maximum iterations
   int x, y;                   // pixel location
   int w, h;                   // pixel dimensions
   arith_type arith;           // arithmetic type to use
+  int step = 1;               // preview spacing; 1 for the full pass
+  int sample = -1;            // anti-aliasing sample (see supersample()), or -1
+  int grid = 1;               // anti-aliasing samples per axis
+  bool first_touch = false;   // clear the tile before computing it
+  // The symmetric partner of (px, py) is (mirror_x - px, mirror_y - py), or
+  // doesn't change on an axis where mirror_x or mirror_y is -1.  Partners of
+  // the tile's pixels that lie in the skip rectangle are copied there.
+  int mirror_x = -1, mirror_y = -1;
+  int skip_x = 0, skip_y = 0, skip_w = 0, skip_h = 0;
+  const FractalJobFactory *factory = nullptr; // where the job came from
+  ReferenceOrbit *reference = nullptr; // orbit to perturb, for arith_perturbation
+  int skip = 0;               // iterations to skip by series approximation
+
+  // Complex-plane coordinates of the tile's columns and rows, filled in by
+  // work() so that pixels don't each need a multiply and divide
+  std::vector<arith_t> column_x, row_y;
+#if SIMD
+  std::vector<double> column_xd, row_yd;
+#endif
+
+  // Statistics, filled in by work()
+  double elapsed = 0;         // wall time in seconds
+  count_t total_iterations = 0; // iterations computed (excluding fast paths)
+  int evaluated = 0;          // pixels computed rather than filled
+  bool done = false;          // work() ran to completion
 
   FractalJob() {}
-  ~FractalJob() {
-    if(dest)
-      dest->release();
-  }
+  ~FractalJob();
+
+  // Return the job to its factory for reuse
+  void recycle() override;
 
   void set(IterBuffer *dest_,
            arith_t xcenter_,
@@ -49,21 +94,71 @@ public:
            int h_,
            arith_type arith_) {
     dest = dest_;
-    xleft = xcenter_ - (dest->width() > dest->height() ? radius_ * dest->width() / dest->height() : radius_);
-    ybottom = ycenter_ - (dest->width() > dest->height() ? radius_ : radius_ * dest->height() / dest->width());
-    xsize = (dest->width() > dest->height() ? radius_ * 2 * dest->width() / dest->height() : radius_ * 2);
+    xleft = xcenter_ - xradius(radius_, dest->width(), dest->height());
+    ybottom = ycenter_ - yradius(radius_, dest->width(), dest->height());
+    xsize = image_xsize(radius_, dest->width(), dest->height());
+    pixel_scale = dest->width() / (double)xsize;
     maxiters = maxiters_;
     x = x_;
     y = y_;
     w = w_;
     h = h_;
     arith = arith_;
+    elapsed = 0;
+    total_iterations = 0;
+    evaluated = 0;
+    done = false;
     dest->acquire();
   }
 
+  // Complex-plane distances from the center of a w x h image to its left and
+  // bottom edges, and its width
+  static arith_t xradius(arith_t radius, int w, int h) {
+    return w > h ? radius * w / h : radius;
+  }
+  static arith_t yradius(arith_t radius, int w, int h) {
+    return w > h ? radius : radius * h / w;
+  }
+  static arith_t image_xsize(arith_t radius, int w, int h) {
+    return w > h ? radius * 2 * w / h : radius * 2;
+  }
+
+  // Complex-plane size of a pixel.  Moving the center by a whole number of
+  // these gives exactly the same pixel coordinates, shifted.
+  static arith_t pixel_size(arith_t radius, int w, int h) {
+    return image_xsize(radius, w, h) / w;
+  }
+
+  // Zoom a w x h image in (zoom = 1) or out (zoom = -1) by a factor of 2
+  // about pixel (px, py), which keeps its coordinates.  The pixel size is
+  // halved or doubled exactly, so every other row and column of the
+  // zoomed-in image is exactly a row or column of the zoomed-out one.
+  // Returns false if the pixel size can't be halved exactly; the zoom still
+  // happens, but pixels can't be reused.
+  static bool zoom2(arith_t &cx, arith_t &cy, arith_t &radius, int w, int h, int px, int py, int zoom);
+
   // Create a new IterBuffer and start to asynchronously populate it.  It will
   // be returned with one ref owned by the caller (and many by the background
   // jobs).  Uncomputed locations are set to -1.
+  //
+  // If preview is more than 1, the image is first computed at 1/preview
+  // resolution and then in full.  Preview jobs only compute pixels whose
+  // coordinates are multiples of their step, and the full pass reuses them.
+  //
+  // If previous is not null, pixels it has in common with the new image are
+  // copied from it (see IterBuffer::copy).  Only tiles left with uncomputed
+  // pixels get jobs.
+  //
+  // arith_auto is resolved here, from the pixel size.  For
+  // arith_perturbation, a reference orbit at the center is shared by all the
+  // jobs.  Unless the factory has kept one that will do (see
+  // FractalJobFactory::kept_reference()), it is computed by a job of its own,
+  // which submits the tiles when it is done.  That job has the same
+  // completion_data, but the completion callback is not called for it.
+  //
+  // Otherwise, if the factory's fractal is symmetric and the image overlaps
+  // itself under that symmetry, the smaller overlapping part gets no jobs; it
+  // is copied from the other part by the jobs that compute it.
   static IterBuffer *recompute(arith_t cx,
                                arith_t cy,
                                arith_t r,
@@ -75,33 +170,247 @@ public:
                                void *completion_data,
                                int xpos,
                                int ypos,
-                               const FractalJobFactory *factory);
+                               const FractalJobFactory *factory,
+                               job_priority priority = job_interactive,
+                               int preview = 1,
+                               IterBuffer *previous = nullptr,
+                               int dx = 0,
+                               int dy = 0,
+                               int zoom = 0);
+
+  // Start to compute sub-samples for anti-aliasing an image made by
+  // recompute() with the same parameters.  There are grid x grid passes,
+  // each appended to passes as a new image owned by the caller.  Each is a
+  // copy of image except at the pixels where selected is true, which are
+  // computed at a point jittered within the pass's cell of a grid x grid
+  // division of the pixel.  Averaging the passes' colours then smooths the
+  // selected pixels and leaves the rest as they are.
+  static void supersample(std::vector<IterBuffer *> &passes,
+                          IterBuffer *image,
+                          const std::vector<bool> &selected,
+                          int grid,
+                          arith_t cx,
+                          arith_t cy,
+                          arith_t r,
+                          int maxiters,
+                          arith_type arith,
+                          void (*completion_callback)(Job *, void *),
+                          void *completion_data,
+                          const FractalJobFactory *factory,
+                          job_priority priority = job_interactive);
 
   // Attempt to fast-path a point
-  // Return true if it can be optimized
+  // Return true if it can be optimized, with r2 as for the iterate functions
   virtual bool fastpath(arith_t cx, arith_t cy, int &iterations, double &r2);
 
   // Calculate and plot px, py
   // Return true if it escapes
   virtual bool sisd_calculate(int px, int py) = 0;
 
+  // Plot the result of iterating px, py.  r2 is as returned by the iterate
+  // functions.  distance is the estimate for an escaped point, in the complex
+  // plane; it's only used if dest->has_distances().
+  inline void plot(int px, int py, int iterations, double r2, double distance = 0) {
+    dest->pixel(px, py) = transform_iterations(iterations, r2, maxiters);
+    if(dest->has_distances())
+      dest->distance(px, py) = iterations == maxiters ? r2 - 1 : distance * pixel_scale;
+  }
+
 #if SIMD
   // Calculate and plot the SIMD points px, py
   // Return true if any of them escape
   virtual bool simd_calculate(int px[SIMD], int py[SIMD]) = 0;
 #endif
 
-  // Do the computation (called in background thread)
-  void work();
-  void sisd_work();
+  // If the job has been cancelled, mark the tile as uncomputed and return
+  // true
+  bool abandon();
+
+  // Fill in column_x and row_y (etc)
+  void coordinates();
+
+  // Complex-plane coordinates of a pixel in the tile
+  inline const arith_t &pixel_x(int px) const {
+    return column_x[px - x];
+  }
+  inline const arith_t &pixel_y(int py) const {
+    return row_y[py - y];
+  }
 #if SIMD
-  void simd_work();
+  inline double pixel_xd(int px) const {
+    return column_xd[px - x];
+  }
+  inline double pixel_yd(int py) const {
+    return row_yd[py - y];
+  }
 #endif
+
+  // Do the computation (called in background thread)
+  void work();
+
+  // Find the part of the skip rectangle that this tile's pixels are copied
+  // to.  Returns false if there is none.
+  bool mirrored(int &mx, int &my, int &mw, int &mh) const;
+
+  // Copy pixels to their symmetric partners in the skip rectangle
+  void mirror();
+
+  // Rectangles no bigger than this in either dimension are computed
+  // directly rather than subdivided
+  static const int min_subdivide = 6;
+
+  // True if a pixel has already been computed, e.g. by a preview pass
+  inline bool known(int px, int py) const {
+    return !std::isnan(dest->pixel(px, py));
+  }
+
+  // Compute a stream of pixels, using SIMD if selected.  Pixels that are
+  // already known are skipped.  Returns false if the job was cancelled.
+  bool calculate(PixelStream &pixels);
+
+  // Fill in the inside of a rectangle whose border has been computed.
+  // Returns false if the job was cancelled.
+  bool subdivide(int rx, int ry, int rw, int rh);
+
+  // True if the border of a rectangle is all the same value
+  bool uniform(int rx, int ry, int rw, int rh);
+
+  // Compute the tile by boundary tracing.  Returns false if the job was
+  // cancelled.
+  bool trace();
+
+  // Working space for trace(), indexed by offset within the tile
+  std::vector<unsigned char> traced;
+  std::vector<int> trace_queue, trace_todo;
+};
+
+// Statistics for one tile, for tuning tile sizes and scheduling
+struct TileStats {
+  int x, y, w, h;     // pixel location and dimensions
+  double elapsed;     // wall time in seconds
+  count_t iterations; // iterations computed
+  int evaluated;      // pixels computed rather than filled
+  arith_type arith;   // arithmetic used
+
+  TileStats(const FractalJob *j):
+      x(j->x),
+      y(j->y),
+      w(j->w),
+      h(j->h),
+      elapsed(j->elapsed),
+      iterations(j->total_iterations),
+      evaluated(j->evaluated),
+      arith(j->arith) {}
 };
 
+// Write tile statistics as CSV.  Returns -1 on error.
+int writeTileStats(FILE *fp, const std::vector<TileStats> &tiles);
+
+// Creates jobs for FractalJob::recompute.  Finished jobs are kept in a pool
+// and reused, rather than being deleted.
 class FractalJobFactory {
 public:
+  FractalJobFactory();
+  FractalJobFactory(const FractalJobFactory &) = delete;
+  FractalJobFactory &operator=(const FractalJobFactory &) = delete;
+  virtual ~FractalJobFactory();
+
+  // Get a job, from the pool if possible
+  FractalJob *get() const;
+
+  // Return a finished job to the pool
+  void put(FractalJob *j) const;
+
+  // Allocation statistics
+  size_t allocated() const {
+    return nallocated;
+  }
+  size_t reused() const {
+    return nreused;
+  }
+
+  // Upper limit on the size of the pool
+  static const size_t max_pool = 16384;
+
+  // If true, images get distance data (see IterBuffer::distance).  Then
+  // every pixel is computed, since filled ones would have none.
+  bool distances = false;
+
+  // If true, orbits attracted to a cycle are recognized from their derivative
+  // (see iterate_attracted()) and stop early, rather than running on to
+  // maxiters, and interior points get their rates in the distance plane.
+  // It's a heuristic, so off by default.
+  bool interior = default_interior;
+
+  // Initial value of interior for new factories
+  static bool default_interior;
+
+  // How jobs from this factory compute their tiles
+  render_strategy strategy = default_strategy;
+
+  // Initial value of strategy for new factories
+  static render_strategy default_strategy;
+
+  // The symmetry of the fractal.  The default is none.
+  virtual fractal_symmetry symmetry() const;
+
+  // Compute the orbit of the point at (x, y) for arith_perturbation.  The
+  // default returns null, and then jobs use full precision instead.  See
+  // ReferenceOrbit for cancel.
+  virtual ReferenceOrbit *reference_orbit(arith_t x, arith_t y, int maxiters, const int *cancel = nullptr) const;
+
+  // True if an orbit from reference_orbit() still belongs to this fractal.
+  // The default is true.
+  virtual bool reference_matches(const ReferenceOrbit *reference) const;
+
+  // Return a new reference to the orbit most recently passed to
+  // keep_reference(), if it can be used for a w x h view centred at (cx, cy)
+  // with radius r: only the center may have changed, and the orbit's point
+  // must still be in view.  Otherwise returns null.
+  ReferenceOrbit *kept_reference(arith_t cx, arith_t cy, arith_t r, int w, int h, int maxiters) const;
+
+  // Keep a reference to an orbit computed for a view with radius r
+  void keep_reference(ReferenceOrbit *reference, arith_t r) const;
+
+  // Record the time taken by a full-pass job whose work() ran to completion
+  void record(const FractalJob *j) const;
+
+  // Choose the tile size for a w x h image, from the times recorded since the
+  // last call, or from arith_cost() if nothing has been timed yet.  Tiles aim
+  // to take about tile_target seconds each, but are made smaller if there
+  // would be too few to keep every thread busy.  The result is always a power
+  // of 2 between min_tile and max_tile.
+  //
+  // The timings belong to the factory, so a sequence of images (such as a
+  // movie) should use the same factory throughout.
+  int tile_size(int w, int h, int maxiters, arith_type arith) const;
+
+  static constexpr double tile_target = 0.01;
+  static const int min_tile = 16, max_tile = 256;
+
+protected:
+  // Create a new job
   virtual FractalJob *create() const = 0;
+
+  // Prepare a pooled job for reuse.  The default does nothing.
+  virtual void reuse(FractalJob *j) const;
+
+private:
+  mutable std::vector<FractalJob *> pool; // jobs available for reuse
+  mutex_t *pool_lock;                     // lock protecting everything below
+  mutable size_t nallocated = 0, nreused = 0;
+
+  // Timings from record(), and the estimate tile_size() made from them
+  mutable double timed_seconds = 0, timed_pixels = 0;
+  mutable int timed_maxiters = 0;
+  mutable arith_type timed_arith = arith_limit;
+  mutable double pixel_seconds = 0; // 0 if unknown
+  mutable int pixel_maxiters = 0;
+  mutable arith_type pixel_arith = arith_limit;
+
+  // From keep_reference()
+  mutable ReferenceOrbit *kept = nullptr;
+  mutable arith_t kept_radius;
 };
 
 #endif /* FRACTALJOB_H */
@@ -16,9 +16,81 @@
 #include "mandy.h"
 #include "IterBuffer.h"
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
 
-IterBuffer::IterBuffer(int w_, int h_): refs(1), xw((w_ + 7) & -8), w(w_), h(h_), data(new count_t[xw * h]) {
-  clear();
+IterBuffer::IterBuffer(int w_, int h_, bool clear_, bool distances_):
+    refs(1), xw((w_ + 7) & -8), w(w_), h(h_), distances(nullptr), untouched(!clear_) {
+  // Large calloc() allocations come straight from fresh pages, which are not
+  // touched until used.
+  if(clear_)
+    data = (count_t *)malloc(xw * h * sizeof(count_t));
+  else
+    data = (count_t *)calloc(xw * h, sizeof(count_t));
+  if(!data)
+    fatal(errno, "allocating %dx%d buffer", w, h);
+  if(clear_)
+    clear();
+  if(distances_ && !(distances = (float *)calloc(xw * h, sizeof(float))))
+    fatal(errno, "allocating %dx%d buffer", w, h);
+}
+
+int IterBuffer::copy(IterBuffer *from, int dx, int dy, int zoom) {
+  if(from->w != w || from->h != h || from->untouched || (distances && !from->distances))
+    return 0;
+  if(zoom) {
+    // Pixel (x, y) here is pixel (dx + (x - dx) / 2, dy + (y - dy) / 2)
+    // there when zooming in, or (dx + (x - dx) * 2, ...) when zooming out.
+    // Only every other pixel lines up when zooming in.
+    int copied = 0;
+    for(int y = 0; y < h; ++y) {
+      int fy;
+      if(zoom > 0) {
+        if((y - dy) % 2)
+          continue;
+        fy = dy + (y - dy) / 2;
+      } else
+        fy = dy + (y - dy) * 2;
+      if(fy < 0 || fy >= h)
+        continue;
+      for(int x = 0; x < w; ++x) {
+        int fx;
+        if(zoom > 0) {
+          if((x - dx) % 2)
+            continue;
+          fx = dx + (x - dx) / 2;
+        } else
+          fx = dx + (x - dx) * 2;
+        if(fx < 0 || fx >= w)
+          continue;
+        pixel(x, y) = from->pixel(fx, fy);
+        if(distances)
+          distance(x, y) = from->distance(fx, fy);
+        ++copied;
+      }
+    }
+    return copied;
+  }
+  const int x0 = std::max(dx, 0), x1 = std::min(w + dx, w);
+  const int y0 = std::max(dy, 0), y1 = std::min(h + dy, h);
+  if(x0 >= x1 || y0 >= y1)
+    return 0;
+  for(int y = y0; y < y1; ++y) {
+    memcpy(&pixel(x0, y), &from->pixel(x0 - dx, y - dy), (x1 - x0) * sizeof(count_t));
+    if(distances)
+      memcpy(&distance(x0, y), &from->distance(x0 - dx, y - dy), (x1 - x0) * sizeof(float));
+  }
+  return (x1 - x0) * (y1 - y0);
+}
+
+bool IterBuffer::computed(int x, int y, int w, int h) {
+  for(int py = y; py < y + h; ++py)
+    for(int px = x; px < x + w; ++px)
+      if(std::isnan(pixel(px, py)))
+        return false;
+  return true;
 }
 
 void IterBuffer::finished() {
@@ -26,7 +98,8 @@ void IterBuffer::finished() {
 }
 
 IterBuffer::~IterBuffer() {
-  delete[] data;
+  free(data);
+  free(distances);
 }
 
 /*
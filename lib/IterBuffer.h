@@ -30,10 +30,17 @@ class IterBuffer {
   int xw, w, h;
   // The actual data.
   count_t *data;
+  // Distance data, or null if not wanted
+  float *distances;
+  // True if the memory was left for other threads to touch first
+  bool untouched;
 
 public:
   // Construct a new IterBuffer with a given size.  The initial refcount is 1.
-  IterBuffer(int w, int h);
+  // If clear is false then the memory is not touched, so that it can be
+  // placed by whichever thread first writes to it; it reads as 0 until then.
+  // If distances is true then there is distance data as well as counts.
+  IterBuffer(int w, int h, bool clear = true, bool distances = false);
   // Acquire a reference.
   IterBuffer *acquire() {
     ATOMIC_INC(refs);
@@ -49,6 +56,21 @@ public:
     return data[y * xw + x];
   }
 
+  // Distance data for a pixel.  For escaped points this is the estimated
+  // distance to the set, in pixels (see distance_estimate()).  For interior
+  // points it is the rate of attraction (see iterate_rate()) - 1, so 0 at the
+  // boundary of the set falling to -1 at the center of a component.  The rate
+  // is only measured if the factory asked for interior detection, so
+  // otherwise it is 0 except in the main cardioid and period-2 bulb.  Only
+  // valid if has_distances() and the pixel has been computed.
+  inline float &distance(int x, int y) {
+    return distances[y * xw + x];
+  }
+
+  inline bool has_distances() const {
+    return distances != nullptr;
+  }
+
   inline int width() const {
     return w;
   }
@@ -59,6 +81,23 @@ public:
   void clear() {
     memset(data, 0xFF, xw * h * sizeof(count_t));
   }
+
+  // Mark a region as uncomputed
+  void clear(int x, int y, int w, int h) {
+    for(int py = y; py < y + h; ++py)
+      memset(&pixel(x, py), 0xFF, w * sizeof(count_t));
+  }
+
+  // Copy the pixels this buffer has in common with another of the same size.
+  // If zoom is 0, pixel (x, y) here is pixel (x - dx, y - dy) there.  If zoom
+  // is 1 this buffer is the other zoomed in by a factor of 2 about pixel
+  // (dx, dy), and if it is -1, zoomed out.  Returns the number of pixels
+  // copied.  Nothing is copied from a buffer that wasn't cleared when it was
+  // created, since it can't tell which pixels are real.
+  int copy(IterBuffer *from, int dx, int dy, int zoom = 0);
+
+  // True if every pixel of a region has been computed
+  bool computed(int x, int y, int w, int h);
 };
 
 #endif /* ITERBUFFER_H */
@@ -16,139 +16,457 @@
 #include "mandy.h"
 #include "Job.h"
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 
-void Job::submit(void (*completion_callback_)(Job *, void *), void *completion_data_) {
+void Job::submit(void (*completion_callback_)(Job *, void *), void *completion_data_, job_priority priority) {
   completion_callback = completion_callback_;
   completion_data = completion_data_;
-  LockAcquire(lock);
-  queue.push_back(this);
+  LockAcquire(owners_lock);
+  owner = ownerFor(completion_data);
+  generation = owner->generation;
+  all_generation = all_generations;
+  ++owner->outstanding;
+  ++outstanding;
+  LockRelease(owners_lock);
+  enqueue(priority);
+}
+
+void Job::spawn(Job *j, void (*completion_callback_)(Job *, void *), job_priority priority) {
+  j->completion_callback = completion_callback_;
+  j->completion_data = completion_data;
+  LockAcquire(owners_lock);
+  j->owner = owner;
+  j->generation = generation;
+  j->all_generation = all_generation;
+  if(j->stale())
+    ++owner->stale;
+  else {
+    ++owner->outstanding;
+    ++outstanding;
+  }
+  LockRelease(owners_lock);
+  j->enqueue(priority);
+}
+
+void Job::enqueue(job_priority priority) {
+  Worker *w = workers[(unsigned)ATOMIC_INC(next_worker) % workers.size()];
+  LockAcquire(w->lock);
+  w->queue[priority].push_back(this);
+  ATOMIC_INC(queued);
+  LockRelease(w->lock);
+  LockAcquire(idle_lock);
   CondSignal(queued_cond);
-  LockRelease(lock);
+  LockRelease(idle_lock);
 }
 
 void Job::cancel(void *completion_data) {
-  LockAcquire(lock);
-  for(std::list<Job *>::iterator it = queue.begin(); it != queue.end();) {
-    std::list<Job *>::iterator here = it;
-    ++it;
-    Job *j = *here;
-    if(completion_data == NULL || j->completion_data == completion_data) {
-      delete j;
-      queue.erase(here);
+  LockAcquire(owners_lock);
+  if(completion_data) {
+    Owner *o = ownerFor(completion_data);
+    ATOMIC_INC(o->generation);
+    outstanding -= o->outstanding;
+    o->stale += o->outstanding;
+    o->outstanding = 0;
+  } else {
+    ATOMIC_INC(all_generations);
+    for(std::map<void *, Owner *>::iterator it = owners.begin(); it != owners.end(); ++it) {
+      it->second->stale += it->second->outstanding;
+      it->second->outstanding = 0;
     }
+    outstanding = 0;
+  }
+  LockRelease(owners_lock);
+  // Tell running jobs to give up.  A job taken after the generation changed
+  // will be discarded by take() instead.
+  for(size_t n = 0; n < workers.size(); ++n) {
+    Worker *w = workers[n];
+    LockAcquire(w->lock);
+    if(w->current && w->current->stale())
+      ATOMIC_SET(w->current->cancelled);
+    LockRelease(w->lock);
+  }
+}
+
+// Owners are few and long-lived (views and factories) so they are never
+// freed.
+Job::Owner *Job::ownerFor(void *completion_data) {
+  Owner *&o = owners[completion_data];
+  if(!o)
+    o = new Owner();
+  return o;
+}
+
+// Called from worker threads.  Only needs the lock if someone is waiting.
+void Job::complete() {
+  Job *head;
+  do {
+    head = ATOMIC_LOAD(owner->completions);
+    next_completed = head;
+  } while(!ATOMIC_CAS(owner->completions, head, this));
+  if(ATOMIC_CAS(notified, 0, 1)) {
+    char c = 0;
+    if(write(notify_fds[1], &c, 1) < 0)
+      fatal(errno, "writing to notification pipe");
+  }
+  wake();
+}
+
+void Job::wake() {
+  if(ATOMIC_GET(waiters)) {
+    LockAcquire(lock);
+    CondBroadcast(completed_cond);
+    LockRelease(lock);
+  }
+}
+
+// The list is built newest first, so reverse it.
+Job *Job::drain(Owner *o) {
+  Job *j = ATOMIC_EXCHANGE(o->completions, (Job *)NULL), *batch = NULL;
+  while(j) {
+    Job *next = j->next_completed;
+    j->next_completed = batch;
+    batch = j;
+    j = next;
   }
-  for(std::list<Job *>::iterator it = completed.begin(); it != completed.end();) {
-    std::list<Job *>::iterator here = it;
-    ++it;
-    Job *j = *here;
-    if(completion_data == NULL || j->completion_data == completion_data) {
-      delete j;
-      completed.erase(here);
+  return batch;
+}
+
+// Stale jobs are dropped without calling their callbacks.
+void Job::deliver(std::vector<Job *> &batch) {
+  for(size_t n = 0; n < batch.size(); ++n) {
+    Job *j = batch[n];
+    if(!j->stale())
+      j->completion_callback(j, j->completion_data);
+  }
+  release(batch);
+}
+
+// Jobs are recycled before they are discounted, since a thread waiting for
+// them may destroy their factory as soon as they are.  Stale jobs were moved
+// from their owner's outstanding count to its stale count when they were
+// cancelled.
+void Job::release(std::vector<Job *> &batch) {
+  if(batch.empty())
+    return;
+  struct Receipt {
+    Owner *owner;
+    int generation, all_generation;
+  };
+  std::vector<Receipt> receipts(batch.size());
+  for(size_t n = 0; n < batch.size(); ++n) {
+    Job *j = batch[n];
+    receipts[n].owner = j->owner;
+    receipts[n].generation = j->generation;
+    receipts[n].all_generation = j->all_generation;
+    j->recycle();
+  }
+  LockAcquire(owners_lock);
+  for(size_t n = 0; n < receipts.size(); ++n) {
+    if(!stale(receipts[n].owner, receipts[n].generation, receipts[n].all_generation)) {
+      --receipts[n].owner->outstanding;
+      --outstanding;
+    } else
+      --receipts[n].owner->stale;
+  }
+  LockRelease(owners_lock);
+  wake();
+  batch.clear();
+}
+
+// Remove o's stale jobs from the queues and from ready, rather than wait for
+// the workers or poll(int) to get round to them.
+void Job::sweep(Owner *o) {
+  std::vector<Job *> discard;
+  auto pick = [o, &discard](std::deque<Job *> &q) {
+    size_t kept = 0;
+    for(size_t n = 0; n < q.size(); ++n) {
+      if(q[n]->owner == o && q[n]->stale())
+        discard.push_back(q[n]);
+      else
+        q[kept++] = q[n];
     }
+    size_t removed = q.size() - kept;
+    q.resize(kept);
+    return removed;
+  };
+  if(!lingering(o))
+    return;
+  LockAcquire(owners_lock);
+  pick(ready);
+  LockRelease(owners_lock);
+  for(size_t n = 0; n < workers.size(); ++n) {
+    Worker *w = workers[n];
+    LockAcquire(w->lock);
+    for(int p = 0; p < job_priorities; ++p)
+      for(size_t removed = pick(w->queue[p]); removed > 0; --removed)
+        ATOMIC_DEC(queued);
+    LockRelease(w->lock);
   }
-  LockRelease(lock);
+  release(discard);
 }
 
-void Job::init(int nthreads) {
+bool Job::lingering(Owner *o) {
+  LockAcquire(owners_lock);
+  bool more = o->stale > 0;
+  LockRelease(owners_lock);
+  return more;
+}
+
+const char *const placement_names[] = {
+    "none",
+    "cores",
+    "nodes",
+};
+
+void Job::init(int nthreads, job_placement placement) {
 #if HAVE_SYSCONF && defined _SC_NPROCESSORS_ONLN
   if(nthreads == -1)
     nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 #endif
-  if(nthreads == -1)
+  if(nthreads <= 0)
     nthreads = 1;
-  queued_cond = CondCreate();
-  completed_cond = CondCreate();
-  lock = LockCreate();
+  if(!lock) {
+    queued_cond = CondCreate();
+    completed_cond = CondCreate();
+    lock = LockCreate();
+    idle_lock = LockCreate();
+    owners_lock = LockCreate();
+    if(pipe(notify_fds) < 0)
+      fatal(errno, "creating notification pipe");
+    for(int n = 0; n < 2; ++n) {
+      if(fcntl(notify_fds[n], F_SETFL, fcntl(notify_fds[n], F_GETFL) | O_NONBLOCK) < 0)
+        fatal(errno, "fcntl");
+      if(fcntl(notify_fds[n], F_SETFD, FD_CLOEXEC) < 0)
+        fatal(errno, "fcntl");
+    }
+  }
+  shutdown = false;
+  placement_policy = placement;
   for(int n = 0; n < nthreads; ++n) {
-    threadid_t id;
-    ThreadCreate(id, worker);
-    workers.push_back(id);
+    Worker *w = new Worker();
+    w->lock = LockCreate();
+    workers.push_back(w);
+  }
+  // Workers only start once all the queues exist, since they may steal
+  // from any of them.
+  for(size_t n = 0; n < workers.size(); ++n)
+    ThreadCreate(workers[n]->id, worker, (void *)n);
+  place();
+}
+
+// Workers are assigned to CPUs in node order, so with placement_cores
+// consecutive workers share a node.  Only CPUs that the process may already
+// run on are used, so that placement works within a cpuset or taskset.
+void Job::place() {
+  if(placement_policy == placement_none)
+    return;
+  std::vector<std::vector<int>> nodes = CpuNodes();
+  if(nodes.empty()) {
+    warning("no NUMA node has a CPU this process may run on; workers are not placed");
+    placement_policy = placement_none;
+    return;
+  }
+  std::vector<int> cpus;
+  for(size_t node = 0; node < nodes.size(); ++node)
+    cpus.insert(cpus.end(), nodes[node].begin(), nodes[node].end());
+  for(size_t n = 0; n < workers.size(); ++n) {
+    bool ok;
+    if(placement_policy == placement_cores)
+      ok = ThreadSetAffinity(workers[n]->id, std::vector<int>(1, cpus[n % cpus.size()]));
+    else
+      ok = ThreadSetAffinity(workers[n]->id, nodes[n % nodes.size()]);
+    if(!ok)
+      fatal(0, "worker placement is not supported on this platform");
   }
 }
 
 void Job::destroy() {
-  LockAcquire(lock);
+  LockAcquire(idle_lock);
   shutdown = true;
   CondBroadcast(queued_cond);
-  LockRelease(lock);
+  LockRelease(idle_lock);
+  for(size_t n = 0; n < workers.size(); ++n)
+    ThreadJoin(workers[n]->id);
+  std::vector<Job *> discard;
   while(workers.size()) {
-    ThreadJoin(workers.back());
+    Worker *w = workers.back();
+    for(int p = 0; p < job_priorities; ++p)
+      discard.insert(discard.end(), w->queue[p].begin(), w->queue[p].end());
+    LockDestroy(w->lock);
+    delete w;
     workers.pop_back();
   }
+  queued = 0;
+  release(discard);
 }
 
-void Job::dequeue() {
-  Job *j = completed.front();
-  completed.pop_front();
-  LockRelease(lock);
-  j->completion_callback(j, j->completion_data);
-  delete j;
-  LockAcquire(lock);
+// ready is protected by owners_lock, since sweep() may remove jobs from it.
+bool Job::poll(int max) {
+  LockAcquire(owners_lock);
+  if(ready.empty()) {
+    LockRelease(owners_lock);
+    // Completions that arrive after this point will notify again.
+    char buffer[64];
+    while(read(notify_fds[0], buffer, sizeof buffer) > 0)
+      ;
+    ATOMIC_EXCHANGE(notified, 0);
+    LockAcquire(owners_lock);
+    for(std::map<void *, Owner *>::iterator it = owners.begin(); it != owners.end(); ++it)
+      for(Job *j = drain(it->second); j; j = j->next_completed)
+        ready.push_back(j);
+  }
+  std::vector<Job *> batch;
+  while(!ready.empty() && max-- > 0) {
+    batch.push_back(ready.front());
+    ready.pop_front();
+  }
+  LockRelease(owners_lock);
+  deliver(batch);
+  LockAcquire(owners_lock);
+  bool more = !ready.empty();
+  LockRelease(owners_lock);
+  return more;
 }
 
-bool Job::dequeue(void *completion_data) {
-  std::list<Job *>::iterator it;
-  for(it = completed.begin(); it != completed.end(); ++it) {
-    Job *j = *it;
-    if(j->completion_data == completion_data)
-      break;
+// poll(int) may have drained some of o's completions into ready without
+// delivering them yet.  They are older than anything still on o's list, so
+// they are taken first.
+void Job::poll(void *completion_data) {
+  LockAcquire(owners_lock);
+  Owner *o = ownerFor(completion_data);
+  LockRelease(owners_lock);
+  std::vector<Job *> batch;
+  bool more = true;
+  while(more) {
+    claim(o, batch);
+    for(Job *j = drain(o); j; j = j->next_completed)
+      batch.push_back(j);
+    deliver(batch);
+    sweep(o);
+    LockAcquire(lock);
+    ATOMIC_INC(waiters);
+    while(!ATOMIC_LOAD(o->completions) && !readyFor(o) && (pendingLocked(completion_data) || lingering(o)))
+      CondWait(completed_cond, lock);
+    ATOMIC_DEC(waiters);
+    more = ATOMIC_LOAD(o->completions) != NULL || readyFor(o);
+    LockRelease(lock);
   }
-  if(it == completed.end())
-    return false;
-  Job *j = *it;
-  completed.erase(it);
-  LockRelease(lock);
-  j->completion_callback(j, j->completion_data);
-  delete j;
-  LockAcquire(lock);
-  return true;
 }
 
-bool Job::poll(int max) {
-  LockAcquire(lock);
-  while(!completed.empty() && max-- > 0)
-    dequeue();
-  bool nowEmpty = completed.empty();
-  LockRelease(lock);
-  return !nowEmpty;
+void Job::claim(Owner *o, std::vector<Job *> &batch) {
+  LockAcquire(owners_lock);
+  size_t kept = 0;
+  for(size_t n = 0; n < ready.size(); ++n) {
+    if(ready[n]->owner == o)
+      batch.push_back(ready[n]);
+    else
+      ready[kept++] = ready[n];
+  }
+  ready.resize(kept);
+  LockRelease(owners_lock);
 }
 
-void Job::poll(void *completion_data) {
-  LockAcquire(lock);
-  while(pendingLocked(completion_data)) {
-    if(!dequeue(completion_data))
-      CondWait(completed_cond, lock);
+bool Job::readyFor(Owner *o) {
+  LockAcquire(owners_lock);
+  bool found = false;
+  for(size_t n = 0; !found && n < ready.size(); ++n)
+    found = ready[n]->owner == o;
+  LockRelease(owners_lock);
+  return found;
+}
+
+// Find a job for worker SELF, most urgent first.
+Job *Job::take(size_t self) {
+  Job *j = NULL;
+  for(int p = 0; !j && p < job_priorities; ++p)
+    j = take(self, p);
+  return j;
+}
+
+// Find a job of the given priority for worker SELF, preferring its own
+// queue.  The job is recorded as the worker's current job before any lock is
+// released, so that cancel() can always find it.  Cancelled jobs are
+// discarded on the way.
+Job *Job::take(size_t self, int priority) {
+  Worker *w = workers[self];
+  Job *j = NULL;
+  std::vector<Job *> discard;
+  LockAcquire(w->lock);
+  std::deque<Job *> &own = w->queue[priority];
+  while(!j && !own.empty()) {
+    j = own.front();
+    own.pop_front();
+    if(j->stale()) {
+      discard.push_back(j);
+      j = NULL;
+    }
   }
-  LockRelease(lock);
+  w->current = j;
+  LockRelease(w->lock);
+  for(size_t n = 1; !j && n < workers.size(); ++n) {
+    size_t other = (self + n) % workers.size();
+    Worker *v = workers[other];
+    std::deque<Job *> &theirs = v->queue[priority];
+    mutex_t *first = other < self ? v->lock : w->lock;
+    mutex_t *second = other < self ? w->lock : v->lock;
+    LockAcquire(first);
+    LockAcquire(second);
+    while(!j && !theirs.empty()) {
+      j = theirs.back();
+      theirs.pop_back();
+      if(j->stale()) {
+        discard.push_back(j);
+        j = NULL;
+      }
+    }
+    w->current = j;
+    LockRelease(second);
+    LockRelease(first);
+  }
+  for(size_t n = 0; n < discard.size(); ++n)
+    ATOMIC_DEC(queued);
+  release(discard);
+  if(j)
+    ATOMIC_DEC(queued);
+  return j;
 }
 
-void *Job::worker(void *) {
-  LockAcquire(lock);
-  while(!shutdown) {
-    if(queue.empty()) {
-      CondWait(queued_cond, lock);
-      continue;
+void *Job::worker(void *arg) {
+  const size_t self = (size_t)arg;
+  Worker *w = workers[self];
+  for(;;) {
+    LockAcquire(idle_lock);
+    while(!shutdown && !ATOMIC_GET(queued))
+      CondWait(queued_cond, idle_lock);
+    bool stop = shutdown;
+    LockRelease(idle_lock);
+    if(stop)
+      break;
+    Job *j;
+    while((j = take(self))) {
+      j->work();
+      LockAcquire(w->lock);
+      w->current = NULL;
+      LockRelease(w->lock);
+      // Nobody wants a stale job's result, so don't wait for a poll to
+      // recycle it.
+      if(j->stale()) {
+        std::vector<Job *> done(1, j);
+        release(done);
+      } else
+        j->complete();
     }
-    Job *j = queue.front();
-    queue.pop_front();
-    working.insert(j);
-    LockRelease(lock);
-    j->work();
-    LockAcquire(lock);
-    working.erase(j);
-    completed.push_back(j);
-    CondSignal(completed_cond);
   }
-  LockRelease(lock);
   return NULL;
 }
 
 Job::~Job() {}
 
 bool Job::pending() {
-  LockAcquire(lock);
-  bool more = !completed.empty() || !queue.empty() || working.size();
-  LockRelease(lock);
+  LockAcquire(owners_lock);
+  bool more = outstanding > 0;
+  LockRelease(owners_lock);
   return more;
 }
 
@@ -160,20 +478,40 @@ bool Job::pending(void *completion_data) {
 }
 
 bool Job::pendingLocked(void *completion_data) {
-  return (find_jobs(completed, completion_data) || find_jobs(queue, completion_data)
-          || find_jobs(working, completion_data));
+  LockAcquire(owners_lock);
+  std::map<void *, Owner *>::const_iterator it = owners.find(completion_data);
+  bool more = it != owners.end() && it->second->outstanding > 0;
+  LockRelease(owners_lock);
+  return more;
+}
+
+int Job::notifier() {
+  return notify_fds[0];
 }
 
 void Job::work() {}
 
-std::list<Job *> Job::queue;
-std::list<Job *> Job::completed;
-std::set<Job *> Job::working;
+void Job::recycle() {
+  delete this;
+}
+
+std::vector<Job::Worker *> Job::workers;
+std::deque<Job *> Job::ready;
 cond_t *Job::queued_cond;
 cond_t *Job::completed_cond;
 mutex_t *Job::lock;
-std::vector<threadid_t> Job::workers;
+mutex_t *Job::idle_lock;
+ATOMIC_TYPE Job::waiters;
+int Job::notify_fds[2];
+ATOMIC_TYPE Job::notified;
+ATOMIC_TYPE Job::queued;
+ATOMIC_TYPE Job::next_worker;
+ATOMIC_TYPE Job::all_generations;
+std::map<void *, Job::Owner *> Job::owners;
+int Job::outstanding;
+mutex_t *Job::owners_lock;
 bool Job::shutdown;
+job_placement Job::placement_policy;
 
 /*
 Local Variables:
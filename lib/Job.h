@@ -17,32 +17,131 @@
 #define JOB_H
 
 #include "IterBuffer.h"
-#include <list>
-#include <set>
+#include <deque>
+#include <map>
 #include <vector>
 #include "Threading.h"
 
+// Scheduling classes, most urgent first
+enum job_priority {
+  job_interactive, // work the user is waiting to see
+  job_batch,       // background work, e.g. movie frames
+  job_priorities,
+};
+
+// Where worker threads run
+enum job_placement {
+  placement_none,  // wherever the OS likes
+  placement_cores, // each worker pinned to one CPU
+  placement_nodes, // each worker confined to one NUMA node, round-robin
+  placement_limit,
+};
+
+extern const char *const placement_names[];
+
 /* Base class for jobs passed to worker threads.  Agnostic about what the job
  * actually does.  A key point is that the number of threads matches the number
  * of cores, the idea being that all the work gets done with a minimum of
- * context switching. */
+ * context switching.
+ *
+ * Each worker has its own queue, protected by its own lock.  Submitted jobs
+ * are distributed round-robin between the queues; a worker that runs out of
+ * jobs steals from the back of another worker's queue.  There is a queue for
+ * each priority; no job is started while a more urgent one is queued anywhere.
+ *
+ * Each distinct completion_data value is an owner.  Cancellation is by
+ * generation: each owner has a counter, and a job remembers its value at
+ * submission.  cancel() just bumps the counter; stale jobs are discarded when
+ * they are next encountered, or when someone polls for their owner.  Owners
+ * also count their outstanding jobs, so that pending() doesn't have to search
+ * for them, and their stale jobs, so that poll() can wait for them.
+ *
+ * Finished jobs are pushed onto their owner's completion list without taking
+ * any lock.  A consumer takes the whole list with a single atomic exchange, so
+ * it can deliver any number of completions per poll.  The first completion
+ * after the main thread's last poll also writes a byte to a pipe, so that an
+ * event loop can sleep until there is something to deliver.
+ *
+ * Lock ordering: worker locks are taken in index order, and the global lock
+ * comes before owners_lock. */
 class Job {
 public:
   void (*completion_callback)(Job *, void *); // called upon completion
   void *completion_data;                      // passed to callback
+  int cancelled = 0;                          // set if cancelled while running
 
 private:
-  static std::list<Job *> queue;          // job queue
-  static std::set<Job *> working;         // jobs being processed
-  static std::list<Job *> completed;      // completed jobs
+  // Per-owner state
+  struct Owner {
+    ATOMIC_TYPE generation = 0; // bumped by cancel()
+    int outstanding = 0;        // live jobs submitted but not yet delivered
+    int stale = 0;              // cancelled jobs not yet recycled
+    Job *completions = nullptr; // finished jobs, newest first
+  };
+
+  Owner *owner = nullptr;  // owner of this job
+  int generation = 0;      // owner's generation at submission
+  int all_generation = 0;  // value of all_generations at submission
+  Job *next_completed = nullptr; // link in completion list
+
+  // True if a job submitted at these generations has since been cancelled
+  static bool stale(Owner *o, int generation, int all_generation) {
+    return ATOMIC_GET(o->generation) != generation || ATOMIC_GET(all_generations) != all_generation;
+  }
+
+  // True if the job has been cancelled since it was submitted
+  bool stale() const {
+    return stale(owner, generation, all_generation);
+  }
+
+  void complete(); // add to owner's completion list
+  void enqueue(job_priority priority); // add to a worker's queue
+
+  // Per-worker state
+  struct Worker {
+    mutex_t *lock;           // lock protecting queue and current
+    std::deque<Job *> queue[job_priorities]; // jobs assigned to this worker
+    Job *current = nullptr;  // job being processed
+    threadid_t id;           // thread ID
+  };
+
+  static std::vector<Worker *> workers;   // worker threads
+  static std::deque<Job *> ready;         // drained by poll(int) but not yet delivered
+                                          // (protected by owners_lock)
   static cond_t *queued_cond;             // signaled when a job is queued
   static cond_t *completed_cond;          // signaled when a job is completed
-  static mutex_t *lock;                   // lock protecting jobs
-  static std::vector<threadid_t> workers; // worker thread IDs
+  static mutex_t *lock;                   // lock for threads waiting in poll(void *)
+  static ATOMIC_TYPE waiters;             // number of threads waiting in poll(void *)
+  static int notify_fds[2];               // pipe for notifier()
+  static ATOMIC_TYPE notified;            // set when a byte is in notify_fds
+  static mutex_t *idle_lock;              // lock for idle workers
+  static ATOMIC_TYPE queued;              // number of queued jobs
+  static ATOMIC_TYPE next_worker;         // next queue to submit to
+  static ATOMIC_TYPE all_generations;     // bumped by cancel(NULL)
+  static std::map<void *, Owner *> owners; // owners by completion_data
+  static int outstanding;                 // total outstanding jobs
+  static mutex_t *owners_lock;            // lock protecting owners
   static bool shutdown;                   // shutdown flag
+  static job_placement placement_policy;  // worker placement policy
+  static void place();                    // apply placement_policy
   static void *worker(void *);            // work thread
-  static void dequeue();
-  static bool dequeue(void *completion_data);
+  static Job *take(size_t self);          // find a job for a worker
+  static Job *take(size_t self, int priority);
+  static Owner *ownerFor(void *completion_data); // (caller must hold owners_lock)
+  static Job *drain(Owner *o);            // take o's completions, oldest first
+  static void deliver(std::vector<Job *> &batch);
+  static void release(std::vector<Job *> &batch); // recycle and discount jobs
+  static void sweep(Owner *o);            // discard o's queued stale jobs
+  static void claim(Owner *o, std::vector<Job *> &batch); // take o's jobs from ready
+  static bool readyFor(Owner *o);         // any of o's jobs in ready?
+  static bool lingering(Owner *o);        // o has unrecycled stale jobs?
+  static void wake();                     // wake threads waiting in poll(void *)
+
+protected:
+  // Submit j from within work(), on behalf of this job.  j has the same owner
+  // and generation as this job, so if this job has been cancelled, so has j,
+  // however late it is submitted.
+  void spawn(Job *j, void (*completion_callback)(Job *, void *), job_priority priority);
 
 public:
   virtual ~Job();
@@ -50,28 +149,51 @@ public:
   // Override in derived class to define what the job does
   virtual void work();
 
+  // Dispose of the job once it is finished with.  The default deletes it;
+  // derived classes may override this to reuse job objects.
+  virtual void recycle();
+
   // Submit the job.  It will be run at some point in a background thread
-  // unless cancel() is called before it reaches the head of the queue.
+  // unless cancel() is called before it reaches the head of the queue.  It
+  // will not be started while any job of more urgent priority is queued.
   //
   // completion_callback() will be called from inside poll().  No locks will be
   // held while it's being called, making it safe to invoke Job::submit(),
   // Job::cancel() and even Job::poll().  After the completion callback returns
-  // the job will be deleted.
-  void submit(void (*completion_callback)(Job *, void *), void *completion_data = NULL);
+  // the job will be recycled.
+  void submit(void (*completion_callback)(Job *, void *),
+              void *completion_data = NULL,
+              job_priority priority = job_interactive);
 
-  // Cancel outstanding jobs with matching completion_data.
-  // Jobs already in progress will still complete.
+  // Cancel outstanding jobs with matching completion_data, or all jobs if it
+  // is NULL.  Its cost does not depend on the number of queued jobs.
+  // Jobs already in progress have their cancelled flag set; they may give up
+  // early or run to completion, but either way their completion callbacks
+  // will not be called.
+  //
+  // Cancelled jobs may still be recycled after cancel() returns.  Follow it
+  // with poll(completion_data) before destroying anything they refer to.
   static void cancel(void *completion_data);
 
-  // Wait for up to max jobs, and execute their completion callbacks in this
-  // thread.  This must only be used from the main thread.
+  // Execute the completion callbacks of up to max finished jobs in this
+  // thread.  Returns true if there are more to deliver.  This must only be
+  // used from the main thread.
   static bool poll(int max = 16);
 
+  // Returns a file descriptor that becomes readable when there are completed
+  // jobs for poll(int) to deliver.  poll(int) takes care of emptying it.
+  static int notifier();
+
   // Wait for all jobs with matching completion_data and execute their
   // completion callbacks in this thread.  This can be used from any thread
   // that the matched jobs will accept being run in.
+  //
+  // When it returns, every job submitted with matching completion_data,
+  // including cancelled ones, has been recycled.
   static void poll(void *completion_data);
 
+  // A job is pending from submission until its completion callback has
+  // returned.  These all take constant time.
   static bool pending();                            // any work left?
   static bool pending(void *completion_data);       // any work left with matching
                                                     // completion_data?
@@ -80,17 +202,20 @@ public:
                                                     // completion_data?
                                                     // (Caller must hold lock)
 
-  static void init(int nthreads = -1); // initialize thread pool
-  static void destroy();               // destroy thread pool
+  // Return the worker placement policy.  If it is not placement_none then
+  // jobs should allocate their memory by first touch.
+  static job_placement placement() {
+    return placement_policy;
+  }
 
-  template <class T> static bool find_jobs(const T &collection, void *completion_data) {
-    for(typename T::const_iterator it = collection.begin(); it != collection.end(); ++it) {
-      const Job *j = *it;
-      if(j->completion_data == completion_data)
-        return true;
-    }
-    return false;
+  // Return the number of worker threads
+  static int threads() {
+    return workers.size();
   }
+
+  // Initialize the thread pool
+  static void init(int nthreads = -1, job_placement placement = placement_none);
+  static void destroy();               // destroy thread pool
 };
 
 #endif /* JOB_H */
@@ -19,13 +19,24 @@
 #include <cstring>
 #include "arith.h"
 #include "simdarith.h"
+#include "ReferenceOrbit.h"
 
 bool JuliaJob::sisd_calculate(int px, int py) {
-  arith_t zx = xleft + arith_t(px) * xsize / dest->width();
-  arith_t zy = ybottom + arith_t(dest->height() - 1 - py) * xsize / dest->width();
+  arith_t zx = pixel_x(px);
+  arith_t zy = pixel_y(py);
   double r2;
-  int iterations = iterate(zx, zy, cx, cy, maxiters, arith, r2);
-  dest->pixel(px, py) = transform_iterations(iterations, r2, maxiters);
+  int iterations;
+  derivative d(false);
+  derivative *dp = dest->has_distances() ? &d : nullptr;
+  if(reference)
+    iterations = reference->iterate((double)(zx - reference->zx0), (double)(zy - reference->zy0), 0, 0, maxiters, r2,
+                                    &cancelled, skip, dp, factory->interior);
+  else
+    iterations = iterate(zx, zy, cx, cy, maxiters, arith, r2, &cancelled, dp, factory->interior);
+  if(iterations < 0)
+    return true; // cancelled
+  plot(px, py, iterations, r2, dp ? d.distance() : 0);
+  total_iterations += iterations;
   return iterations != maxiters;
 }
 
@@ -36,16 +47,32 @@ bool JuliaJob::simd_calculate(int px[SIMD], int py[SIMD]) {
   double zyvalues[SIMD];
   const double cxvalues[SIMD] = {SIMD_REP(cxd)};
   const double cyvalues[SIMD] = {SIMD_REP(cyd)};
-  for(int i = 0; i < SIMD; i++) {
-    zxvalues[i] = (double)(xleft + arith_t(px[i]) * xsize / dest->width());
-    zyvalues[i] = (double)(ybottom + arith_t(dest->height() - 1 - py[i]) * xsize / dest->width());
-  }
   double r2values[SIMD];
   int iterations[SIMD];
-  simd_iterate(zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, 0);
+  double distances[SIMD] = {SIMD_REP(0)};
+  double *dp = dest->has_distances() ? distances : nullptr;
+  if(reference) {
+    const double zero[SIMD] = {SIMD_REP(0)};
+    for(int i = 0; i < SIMD; i++) {
+      zxvalues[i] = (double)(pixel_x(px[i]) - reference->zx0);
+      zyvalues[i] = (double)(pixel_y(py[i]) - reference->zy0);
+    }
+    reference->simd_iterate(
+        zxvalues, zyvalues, zero, zero, maxiters, iterations, r2values, &cancelled, skip, dp, factory->interior);
+  } else {
+    for(int i = 0; i < SIMD; i++) {
+      zxvalues[i] = pixel_xd(px[i]);
+      zyvalues[i] = pixel_yd(py[i]);
+    }
+    simd_iterate(
+        zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, 0, &cancelled, dp, factory->interior);
+  }
+  if(iterations[0] < 0)
+    return true; // cancelled
   bool escaped = false;
   for(int i = 0; i < SIMD; i++) {
-    dest->pixel(px[i], py[i]) = transform_iterations(iterations[i], r2values[i], maxiters);
+    plot(px[i], py[i], iterations[i], r2values[i], distances[i]);
+    total_iterations += iterations[i];
     escaped |= (iterations[i] != maxiters);
   }
   return escaped;
@@ -56,6 +83,27 @@ FractalJob *JuliaJobFactory::create() const {
   return new JuliaJob(cx, cy);
 }
 
+void JuliaJobFactory::reuse(FractalJob *j) const {
+  JuliaJob *jj = static_cast<JuliaJob *>(j);
+  jj->cx = cx;
+  jj->cy = cy;
+}
+
+ReferenceOrbit *JuliaJobFactory::reference_orbit(arith_t x, arith_t y, int maxiters, const int *cancel) const {
+  return new ReferenceOrbit(x, y, cx, cy, maxiters, true, cancel);
+}
+
+// The constant may have changed since the orbit was computed
+bool JuliaJobFactory::reference_matches(const ReferenceOrbit *reference) const {
+  return reference->cx == cx && reference->cy == cy;
+}
+
+// z and -z have the same square, so their orbits only differ in the
+// starting point
+fractal_symmetry JuliaJobFactory::symmetry() const {
+  return symmetry_rotation;
+}
+
 /*
 Local Variables:
 mode:c++
@@ -20,6 +20,7 @@
 
 class JuliaJob: public FractalJob {
   arith_t cx, cy;
+  friend class JuliaJobFactory;
 
 public:
   JuliaJob(arith_t cx_, arith_t cy_): cx(cx_), cy(cy_) {}
@@ -34,7 +35,14 @@ class JuliaJobFactory: public FractalJobFactory {
 public:
   JuliaJobFactory(): cx(0), cy(0) {}
   arith_t cx, cy;
-  FractalJob *create() const;
+
+  fractal_symmetry symmetry() const override;
+  ReferenceOrbit *reference_orbit(arith_t x, arith_t y, int maxiters, const int *cancel = nullptr) const override;
+  bool reference_matches(const ReferenceOrbit *reference) const override;
+
+protected:
+  FractalJob *create() const override;
+  void reuse(FractalJob *j) const override;
 };
 
 #endif /* JULIAJOB_H */
@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <cstring>
 #include "arith.h"
+#include "ReferenceOrbit.h"
 
 bool MandelbrotJob::fastpath(arith_t cx, arith_t cy, int &iterations, double &r2) {
   const arith_t cxq = (cx - 0.25);
@@ -26,10 +27,13 @@ bool MandelbrotJob::fastpath(arith_t cx, arith_t cy, int &iterations, double &r2
 
   bool fast = false;
 
-  if(arith_t(4) * q * (q + cxq) < cy2) // Main cardioid
+  if(arith_t(4) * q * (q + cxq) < cy2) { // Main cardioid
     fast = true;
-  else if(cx * cx + arith_t(2) * cx + 1 + cy2 < arith_t(1) / arith_t(16)) // Period-2 bulb
+    r2 = cardioid_rate((double)cx, (double)cy);
+  } else if(cx * cx + arith_t(2) * cx + 1 + cy2 < arith_t(1) / arith_t(16)) { // Period-2 bulb
     fast = true;
+    r2 = bulb_rate((double)cx, (double)cy);
+  }
 
 #if 0
   {
@@ -63,29 +67,36 @@ bool MandelbrotJob::fastpath(arith_t cx, arith_t cy, int &iterations, double &r2
   }
 #endif
 
-  if(fast) {
+  if(fast)
     iterations = maxiters;
-    r2 = 0.0;
-  }
 
   return fast;
 }
 
 bool MandelbrotJob::sisd_calculate(int px, int py) {
   // Complex-plane location of this point
-  const arith_t cx = xleft + arith_t(px) * xsize / dest->width();
-  const arith_t cy = ybottom + arith_t(dest->height() - 1 - py) * xsize / dest->width();
+  const arith_t &cx = pixel_x(px);
+  const arith_t &cy = pixel_y(py);
   // let c = cx + icy
   // let z = zx + izy
   //
   // then z^2 + c = zx^2 - zy^2 + cx + i(2zxzy+cy)
   int iterations = 0;
   double r2 = 0.0;
+  derivative d(true);
+  derivative *dp = dest->has_distances() ? &d : nullptr;
   if(!fastpath(cx, cy, iterations, r2)) {
     arith_t zx = 0, zy = 0;
-    iterations = iterate(zx, zy, cx, cy, maxiters, arith, r2);
+    if(reference)
+      iterations = reference->iterate(0, 0, (double)(cx - reference->cx), (double)(cy - reference->cy), maxiters, r2,
+                                      &cancelled, skip, dp, factory->interior);
+    else
+      iterations = iterate(zx, zy, cx, cy, maxiters, arith, r2, &cancelled, dp, factory->interior);
+    if(iterations < 0)
+      return true; // cancelled
   }
-  dest->pixel(px, py) = transform_iterations(iterations, r2, maxiters);
+  plot(px, py, iterations, r2, dp ? d.distance() : 0);
+  total_iterations += iterations;
   return iterations != maxiters;
 }
 
@@ -95,16 +106,55 @@ bool MandelbrotJob::simd_calculate(int px[SIMD], int py[SIMD]) {
   const double zyvalues[SIMD] = {SIMD_REP(0)};
   double cxvalues[SIMD];
   double cyvalues[SIMD];
-  for(int i = 0; i < SIMD; i++) {
-    cxvalues[i] = (double)(xleft + arith_t(px[i]) * xsize / dest->width());
-    cyvalues[i] = (double)(ybottom + arith_t(dest->height() - 1 - py[i]) * xsize / dest->width());
-  }
   double r2values[SIMD];
   int iterations[SIMD];
-  simd_iterate(zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, 1);
+  double distances[SIMD] = {SIMD_REP(0)};
+  double *dp = dest->has_distances() ? distances : nullptr;
+  if(reference) {
+    // The cardioid and bulb tests need full precision, so are done a pixel at
+    // a time.  Lanes that pass them are filled with a copy of another lane.
+    bool fast[SIMD];
+    int slow = -1;
+    for(int i = 0; i < SIMD; i++) {
+      const arith_t &cx = pixel_x(px[i]), &cy = pixel_y(py[i]);
+      if(!(fast[i] = fastpath(cx, cy, iterations[i], r2values[i]))) {
+        cxvalues[i] = (double)(cx - reference->cx);
+        cyvalues[i] = (double)(cy - reference->cy);
+        slow = i;
+      }
+    }
+    if(slow >= 0) {
+      for(int i = 0; i < SIMD; i++)
+        if(fast[i]) {
+          cxvalues[i] = cxvalues[slow];
+          cyvalues[i] = cyvalues[slow];
+        }
+      double perturbed_r2[SIMD];
+      int perturbed_iterations[SIMD];
+      reference->simd_iterate(zxvalues, zyvalues, cxvalues, cyvalues, maxiters, perturbed_iterations, perturbed_r2,
+                              &cancelled, skip, dp, factory->interior);
+      if(perturbed_iterations[0] < 0)
+        return true; // cancelled
+      for(int i = 0; i < SIMD; i++)
+        if(!fast[i]) {
+          iterations[i] = perturbed_iterations[i];
+          r2values[i] = perturbed_r2[i];
+        }
+    }
+  } else {
+    for(int i = 0; i < SIMD; i++) {
+      cxvalues[i] = pixel_xd(px[i]);
+      cyvalues[i] = pixel_yd(py[i]);
+    }
+    simd_iterate(
+        zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, 1, &cancelled, dp, factory->interior);
+    if(iterations[0] < 0)
+      return true; // cancelled
+  }
   bool escaped = false;
   for(int i = 0; i < SIMD; i++) {
-    dest->pixel(px[i], py[i]) = transform_iterations(iterations[i], r2values[i], maxiters);
+    plot(px[i], py[i], iterations[i], r2values[i], distances[i]);
+    total_iterations += iterations[i];
     escaped |= (iterations[i] != maxiters);
   }
   return escaped;
@@ -115,6 +165,15 @@ FractalJob *MandelbrotJobFactory::create() const {
   return new MandelbrotJob();
 }
 
+ReferenceOrbit *MandelbrotJobFactory::reference_orbit(arith_t x, arith_t y, int maxiters, const int *cancel) const {
+  return new ReferenceOrbit(0, 0, x, y, maxiters, false, cancel);
+}
+
+// Conjugating c conjugates every point of its orbit
+fractal_symmetry MandelbrotJobFactory::symmetry() const {
+  return symmetry_conjugate;
+}
+
 /*
 Local Variables:
 mode:c++
@@ -30,7 +30,11 @@ public:
 
 class MandelbrotJobFactory: public FractalJobFactory {
 public:
-  FractalJob *create() const;
+  fractal_symmetry symmetry() const override;
+  ReferenceOrbit *reference_orbit(arith_t x, arith_t y, int maxiters, const int *cancel = nullptr) const override;
+
+protected:
+  FractalJob *create() const override;
 };
 
 #endif /* MANDELBROTJOB_H */
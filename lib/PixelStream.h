@@ -16,6 +16,8 @@
 #ifndef PIXELSTREAM_H
 #define PIXELSTREAM_H
 
+#include <vector>
+
 // Generate a stream of integer pixel coordinates
 class PixelStream {
 public:
@@ -56,6 +58,61 @@ private:
   int m_px, m_py;
 };
 
+// Pixels in a rectangle whose coordinates are both multiples of step
+class PixelStreamGrid: public PixelStream {
+public:
+  PixelStreamGrid(int x, int y, int w, int h, int step):
+      m_min_x((x + step - 1) / step * step),
+      m_min_y((y + step - 1) / step * step),
+      m_limit_x(x + w),
+      m_limit_y(y + h),
+      m_step(step),
+      m_px(m_min_x),
+      m_py(m_min_y) {}
+  bool next(int &px, int &py) override {
+    if(m_py >= m_limit_y || m_min_x >= m_limit_x) {
+      px = m_min_x;
+      py = m_min_y;
+      return false;
+    }
+    px = m_px;
+    py = m_py;
+    m_px += m_step;
+    if(m_px >= m_limit_x) {
+      m_px = m_min_x;
+      m_py += m_step;
+    }
+    return true;
+  }
+
+private:
+  int m_min_x, m_min_y, m_limit_x, m_limit_y, m_step;
+  int m_px, m_py;
+};
+
+// Pixels from a list of offsets within a w-pixel-wide rectangle at x, y
+class PixelStreamList: public PixelStream {
+public:
+  PixelStreamList(const std::vector<int> &offsets, int x, int y, int w):
+      m_offsets(offsets), m_x(x), m_y(y), m_w(w) {}
+  bool next(int &px, int &py) override {
+    if(m_next >= m_offsets.size()) {
+      px = m_x;
+      py = m_y;
+      return false;
+    }
+    px = m_x + m_offsets[m_next] % m_w;
+    py = m_y + m_offsets[m_next] / m_w;
+    ++m_next;
+    return true;
+  }
+
+private:
+  const std::vector<int> &m_offsets;
+  int m_x, m_y, m_w;
+  size_t m_next = 0;
+};
+
 class PixelStreamEdge: public PixelStream {
 public:
   PixelStreamEdge(int x, int y, int w, int h):
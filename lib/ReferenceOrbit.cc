@@ -0,0 +1,238 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "ReferenceOrbit.h"
+#include "simdarith.h"
+#include <algorithm>
+
+// Relative size of the first neglected term of the series approximation
+static const double series_tolerance = 1e-12;
+
+ReferenceOrbit::ReferenceOrbit(
+    arith_t zx_, arith_t zy_, arith_t cx_, arith_t cy_, int maxiters_, bool vary_z_, const int *cancel):
+    refs(1), zx0(zx_), zy0(zy_), cx(cx_), cy(cy_), maxiters(maxiters_), vary_z(vary_z_) {
+  arith_t x = zx0, y = zy0;
+  for(int iterations = 0;; ++iterations) {
+    zx.push_back((double)x);
+    zy.push_back((double)y);
+    const arith_t x2 = x.square(), y2 = y.square();
+    if(x2 + y2 >= arith_t(R2LIMIT) || iterations >= maxiters)
+      break;
+    if(iterate_cancelled(iterations, cancel))
+      return;
+    y = arith_t(2) * x * y + cy;
+    x = x2 - y2 + cx;
+  }
+  // Substituting the series into dz -> (2Z + dz)dz + dc (see below) and
+  // equating powers of d gives
+  //
+  //   a -> 2Za + 1 (or just 2Za if d is in z rather than c)
+  //   b -> 2Zb + a^2
+  //   c -> 2Zc + 2ab
+  //
+  // The c term estimates the error from truncating the series, so the series
+  // is abandoned when it gets too large compared with the a term.  It's never
+  // used at the last point, since the reference escapes there.
+  series_terms t = {vary_z ? 1.0 : 0.0, 0, 0, 0, 0, 0, HUGE_VAL};
+  const int last = zx.size() - 1;
+  for(int n = 0; n < last; ++n) {
+    const double a = hypot(t.ar, t.ai), c = hypot(t.cr, t.ci);
+    if(!std::isfinite(a) || !std::isfinite(c))
+      break;
+    if(c > 0)
+      t.radius = std::min(t.radius, sqrt(series_tolerance * a / c));
+    if(!(t.radius > 0))
+      break;
+    series.push_back(t);
+    const double tzx = 2 * zx[n], tzy = 2 * zy[n];
+    const series_terms u = t;
+    t.ar = tzx * u.ar - tzy * u.ai + (vary_z ? 0 : 1);
+    t.ai = tzx * u.ai + tzy * u.ar;
+    t.br = tzx * u.br - tzy * u.bi + u.ar * u.ar - u.ai * u.ai;
+    t.bi = tzx * u.bi + tzy * u.br + 2 * u.ar * u.ai;
+    t.cr = tzx * u.cr - tzy * u.ci + 2 * (u.ar * u.br - u.ai * u.bi);
+    t.ci = tzx * u.ci + tzy * u.cr + 2 * (u.ar * u.bi + u.ai * u.br);
+  }
+}
+
+int ReferenceOrbit::skippable(arith_t left, arith_t bottom, arith_t right, arith_t top) const {
+  const arith_t &ox = vary_z ? zx0 : cx, &oy = vary_z ? zy0 : cy;
+  const double dl = (double)(left - ox), db = (double)(bottom - oy);
+  const double dr = (double)(right - ox), dt = (double)(top - oy);
+  const double d = sqrt(std::max(dl * dl, dr * dr) + std::max(db * db, dt * dt));
+  const auto end
+      = std::partition_point(series.begin(), series.end(), [d](const series_terms &t) { return t.radius >= d; });
+  return std::max(int(end - series.begin()) - 1, 0);
+}
+
+void ReferenceOrbit::approximate(int n, double dx, double dy, double &dzx, double &dzy) const {
+  const series_terms &t = series[n];
+  // Horner's rule: dz = d(a + d(b + dc))
+  double x = t.br + (dx * t.cr - dy * t.ci), y = t.bi + (dx * t.ci + dy * t.cr);
+  double nx = t.ar + (dx * x - dy * y);
+  y = t.ai + (dx * y + dy * x);
+  x = nx;
+  dzx = dx * x - dy * y;
+  dzy = dx * y + dy * x;
+}
+
+void ReferenceOrbit::approximate_derivative(int n, double dx, double dy, double &ddx, double &ddy) const {
+  const series_terms &t = series[n];
+  // a + d(2b + 3dc)
+  const double x = 2 * t.br + 3 * (dx * t.cr - dy * t.ci), y = 2 * t.bi + 3 * (dx * t.ci + dy * t.cr);
+  ddx = t.ar + (dx * x - dy * y);
+  ddy = t.ai + (dx * y + dy * x);
+}
+
+// Writing Z for the reference and Z + dz for the point being iterated,
+//
+//   Z + dz -> (Z + dz)^2 + C + dc = (Z^2 + C) + (2Z + dz)dz + dc
+//
+// so dz -> (2Z + dz)dz + dc.  dz is small, so this can be done in double
+// precision even if Z and C need more.
+int ReferenceOrbit::iterate(double dzx,
+                            double dzy,
+                            double dcx,
+                            double dcy,
+                            int maxiters,
+                            double &r2,
+                            const int *cancel,
+                            int skip,
+                            derivative *d,
+                            bool interior) const {
+  const int last = zx.size() - 1;
+  if(!last) // the reference escaped straight away, so there's nothing to follow
+    return defaultIterate(zx[0] + dzx, zy[0] + dzy, (double)cx + dcx, (double)cy + dcy, maxiters, r2, cancel, d,
+                          interior);
+  int n = 0, iterations = 0;
+  if(skip > 0) {
+    double sx, sy;
+    approximate(skip, vary_z ? dzx : dcx, vary_z ? dzy : dcy, sx, sy);
+    const double x = zx[skip] + sx, y = zy[skip] + sy;
+    // If the point has already escaped then its count is unknown, so it has
+    // to be iterated from the start
+    if(x * x + y * y < R2LIMIT) {
+      if(d)
+        approximate_derivative(skip, vary_z ? dzx : dcx, vary_z ? dzy : dcy, d->x, d->y);
+      dzx = sx;
+      dzy = sy;
+      n = iterations = skip;
+    }
+  }
+  double dz2 = 1, saved_dz2 = HUGE_VAL; // see iterate_attracted()
+  for(;;) {
+    const double x = zx[n] + dzx, y = zy[n] + dzy;
+    r2 = x * x + y * y;
+    if(r2 >= R2LIMIT) {
+      if(d)
+        d->escape(x, y, (double)cx + dcx, (double)cy + dcy);
+      return iterations;
+    }
+    if(iterations >= maxiters) {
+      r2 = 1; // rate unknown
+      return iterations;
+    }
+    if(interior)
+      iterate_derivative(iterations, dz2, r2);
+    if(d)
+      d->step(x, y);
+    // Rebase if the point is nearer the start of the reference than its
+    // current position
+    const double ex = x - zx[0], ey = y - zy[0];
+    if(n == last || ex * ex + ey * ey < dzx * dzx + dzy * dzy) {
+      dzx = ex;
+      dzy = ey;
+      n = 0;
+    }
+    const double tx = 2 * zx[n] + dzx, ty = 2 * zy[n] + dzy;
+    const double nx = tx * dzx - ty * dzy + dcx;
+    dzy = tx * dzy + ty * dzx + dcy;
+    dzx = nx;
+    ++n;
+    ++iterations;
+    if(iterate_cancelled(iterations, cancel))
+      return -1;
+    if(interior && iterate_checkpoint(iterations) && iterate_attracted(iterations, dz2, saved_dz2, r2))
+      return maxiters;
+  }
+}
+
+#if SIMD
+void ReferenceOrbit::simd_iterate(const double *dzx,
+                                  const double *dzy,
+                                  const double *dcx,
+                                  const double *dcy,
+                                  int maxiters,
+                                  int *iterations,
+                                  double *r2values,
+                                  const int *cancel,
+                                  int skip,
+                                  double *distances,
+                                  bool interior) const {
+  const int last = zx.size() - 1;
+  if(!last) {
+    for(int i = 0; i < SIMD; ++i) {
+      derivative d(!vary_z);
+      iterations[i] = iterate(dzx[i], dzy[i], dcx[i], dcy[i], maxiters, r2values[i], cancel, 0,
+                              distances ? &d : nullptr, interior);
+      if(distances)
+        distances[i] = d.distance();
+    }
+    return;
+  }
+  // Starting derivatives and constants, for distances
+  std::vector<derivative> d(SIMD, derivative(!vary_z));
+  double cxvalues[SIMD], cyvalues[SIMD];
+  if(distances)
+    for(int i = 0; i < SIMD; ++i) {
+      cxvalues[i] = (double)cx + dcx[i];
+      cyvalues[i] = (double)cy + dcy[i];
+    }
+  if(skip > 0) {
+    // As in iterate(), but if any point has escaped then they all start from
+    // scratch
+    double sx[SIMD], sy[SIMD];
+    for(int i = 0; i < SIMD; ++i) {
+      approximate(skip, vary_z ? dzx[i] : dcx[i], vary_z ? dzy[i] : dcy[i], sx[i], sy[i]);
+      const double x = zx[skip] + sx[i], y = zy[skip] + sy[i];
+      if(!(x * x + y * y < R2LIMIT)) {
+        skip = 0;
+        break;
+      }
+    }
+    if(skip) {
+      if(distances)
+        for(int i = 0; i < SIMD; ++i)
+          approximate_derivative(skip, vary_z ? dzx[i] : dcx[i], vary_z ? dzy[i] : dcy[i], d[i].x, d[i].y);
+      simd_perturb(zx.data(), zy.data(), last, skip, sx, sy, dcx, dcy, maxiters, iterations, r2values, cancel, d.data(),
+                   cxvalues, cyvalues, distances, interior);
+      return;
+    }
+  }
+  simd_perturb(zx.data(), zy.data(), last, 0, dzx, dzy, dcx, dcy, maxiters, iterations, r2values, cancel, d.data(),
+               cxvalues, cyvalues, distances, interior);
+}
+#endif
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,134 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef REFERENCEORBIT_H
+#define REFERENCEORBIT_H
+
+#include "arith.h"
+#include <vector>
+
+/* The orbit of one point, computed in full precision.  Points near it can be
+ * iterated as double-precision offsets from it ("perturbation"), which is
+ * much faster than iterating them in full precision and, with rebasing (see
+ * iterate()), nearly as accurate.
+ *
+ * Reference-counted in the same way as IterBuffer. */
+class ReferenceOrbit {
+  ATOMIC_TYPE refs;
+  ~ReferenceOrbit() = default;
+
+public:
+  // Compute the orbit of z = zx + i zy under z -> z^2 + c, where c = cx + i
+  // cy, for up to maxiters iterations.  If vary_z is true then other points
+  // differ from the reference in their starting point (Julia sets), otherwise
+  // in their constant (the Mandelbrot set).  The initial refcount is 1.
+  //
+  // If cancel is not null and *cancel becomes nonzero, it gives up early and
+  // the orbit is incomplete.
+  ReferenceOrbit(
+      arith_t zx, arith_t zy, arith_t cx, arith_t cy, int maxiters, bool vary_z, const int *cancel = nullptr);
+
+  ReferenceOrbit *acquire() {
+    ATOMIC_INC(refs);
+    return this;
+  }
+  void release() {
+    if(ATOMIC_DEC(refs) == 0)
+      delete this;
+  }
+
+  arith_t zx0, zy0, cx, cy;   // starting point and constant
+  int maxiters;               // iteration limit it was computed for
+  bool vary_z;                // see constructor
+  std::vector<double> zx, zy; // the orbit, up to the first point to escape
+
+  // Series approximation.  A point whose starting point or constant differs
+  // from the reference's by d has, after n iterations,
+  //
+  //   dz = a d + b d^2 + c d^3 + ...
+  //
+  // where a, b and c depend only on n.  The truncated series is good enough
+  // for |d| <= radius.
+  struct series_terms {
+    double ar, ai, br, bi, cr, ci; // real and imaginary parts of a, b, c
+    double radius;                 // never increases with n
+  };
+  std::vector<series_terms> series;
+
+  // Return the number of iterations that the series approximation can skip
+  // for every point in a rectangle (of starting points or constants,
+  // depending on vary_z)
+  int skippable(arith_t left, arith_t bottom, arith_t right, arith_t top) const;
+
+  // Evaluate the series approximation after n iterations for a point whose
+  // starting point or constant is (dx, dy) from the reference's
+  void approximate(int n, double dx, double dy, double &dzx, double &dzy) const;
+
+  // The derivative of approximate() with respect to d, which is the
+  // derivative of the point's orbit as described in struct derivative
+  void approximate_derivative(int n, double dx, double dy, double &ddx, double &ddy) const;
+
+  // Iterate the point whose starting point is (dzx, dzy) from the
+  // reference's and whose constant is (dcx, dcy) from the reference's.
+  // Results are as for arith_traits<>::iterate.
+  //
+  // If the point gets closer to the start of the reference orbit than to the
+  // reference point at the same iteration, precision would be lost by
+  // carrying on, so it is rebased to follow the reference from the start.
+  // The same happens if it outlives the reference.
+  //
+  // If skip is nonzero then the first skip iterations are replaced by the
+  // series approximation, unless the point escapes during them.
+  //
+  // d and interior are as for defaultIterate().
+  int iterate(double dzx,
+              double dzy,
+              double dcx,
+              double dcy,
+              int maxiters,
+              double &r2,
+              const int *cancel = nullptr,
+              int skip = 0,
+              derivative *d = nullptr,
+              bool interior = false) const;
+
+#if SIMD
+  // SIMD version of iterate().  If distances is not null then distance
+  // estimates for points that escape are stored there.
+  void simd_iterate(const double *dzx,
+                    const double *dzy,
+                    const double *dcx,
+                    const double *dcy,
+                    int maxiters,
+                    int *iterations,
+                    double *r2values,
+                    const int *cancel = nullptr,
+                    int skip = 0,
+                    double *distances = nullptr,
+                    bool interior = false) const;
+#endif
+};
+
+#endif /* REFERENCEORBIT_H */
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
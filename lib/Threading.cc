@@ -15,6 +15,11 @@
  */
 #include "mandy.h"
 #include "Threading.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
 
 mutex_t *LockCreate() {
   int rc;
@@ -38,6 +43,14 @@ void LockRelease(mutex_t *m) {
     fatal(rc, "pthread_mutex_unlock");
 }
 
+void LockDestroy(mutex_t *m) {
+  int rc;
+
+  if((rc = pthread_mutex_destroy(m)))
+    fatal(rc, "pthread_mutex_destroy");
+  delete m;
+}
+
 cond_t *CondCreate() {
   int rc;
   cond_t *c = new cond_t();
@@ -81,6 +94,93 @@ void ThreadJoin(threadid_t &id) {
     fatal(rc, "pthread_join");
 }
 
+bool ThreadSetAffinity(threadid_t &id, const std::vector<int> &cpus) {
+#if HAVE_PTHREAD_SETAFFINITY_NP
+  int rc;
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  for(size_t n = 0; n < cpus.size(); ++n)
+    CPU_SET(cpus[n], &set);
+  if((rc = pthread_setaffinity_np(id, sizeof set, &set)))
+    fatal(rc, "pthread_setaffinity_np");
+  return true;
+#else
+  (void)id;
+  (void)cpus;
+  return false;
+#endif
+}
+
+// Parse a Linux CPU list, e.g. "0-3,8-11"
+static void parseCpuList(const char *s, std::vector<int> &cpus) {
+  char *e;
+  for(;;) {
+    long first = strtol(s, &e, 10), last = first;
+    if(e == s)
+      return;
+    if(*e == '-') {
+      s = e + 1;
+      last = strtol(s, &e, 10);
+      if(e == s)
+        return;
+    }
+    for(long cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+    if(*e != ',')
+      return;
+    s = e + 1;
+  }
+}
+
+// The CPUs that the process may run on, in order
+static std::vector<int> allowedCpus() {
+  std::vector<int> cpus;
+#if HAVE_SCHED_GETAFFINITY
+  cpu_set_t set;
+  if(sched_getaffinity(0, sizeof set, &set) == 0) {
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if(CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    return cpus;
+  }
+#endif
+  int ncpus = 1;
+#if HAVE_SYSCONF && defined _SC_NPROCESSORS_ONLN
+  ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  for(int cpu = 0; cpu < ncpus; ++cpu)
+    cpus.push_back(cpu);
+  return cpus;
+}
+
+std::vector<std::vector<int>> CpuNodes() {
+  const std::vector<int> allowed = allowedCpus();
+  std::vector<std::vector<int>> nodes;
+  bool known = false;
+  for(int node = 0;; ++node) {
+    char path[64], buffer[4096];
+    snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if(!fp)
+      break;
+    known = true;
+    std::vector<int> cpus;
+    if(fgets(buffer, sizeof buffer, fp))
+      parseCpuList(buffer, cpus);
+    fclose(fp);
+    std::vector<int> usable;
+    for(size_t n = 0; n < cpus.size(); ++n)
+      if(std::binary_search(allowed.begin(), allowed.end(), cpus[n]))
+        usable.push_back(cpus[n]);
+    if(usable.size())
+      nodes.push_back(usable);
+  }
+  if(!known)
+    nodes.push_back(allowed);
+  return nodes;
+}
+
 /*
 Local Variables:
 mode:c++
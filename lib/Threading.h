@@ -17,6 +17,7 @@
 #define THREADING_H
 
 #include <pthread.h>
+#include <vector>
 
 typedef pthread_cond_t cond_t;
 typedef pthread_mutex_t mutex_t;
@@ -28,6 +29,7 @@ typedef pthread_t threadid_t;
 mutex_t *LockCreate();
 void LockAcquire(mutex_t *m);
 void LockRelease(mutex_t *m);
+void LockDestroy(mutex_t *m);
 cond_t *CondCreate();
 void CondWait(cond_t *c, mutex_t *m);
 void CondSignal(cond_t *c);
@@ -35,6 +37,15 @@ void CondBroadcast(cond_t *c);
 void ThreadCreate(threadid_t &id, void *(*threadfn)(void *arg), void *arg = NULL);
 void ThreadJoin(threadid_t &id);
 
+// Restrict a thread to a set of CPUs.  Returns false if not supported.
+bool ThreadSetAffinity(threadid_t &id, const std::vector<int> &cpus);
+
+// Return the CPUs belonging to each NUMA node, leaving out any that the
+// process may not run on, and then any nodes left with none.  If the topology
+// is unknown then all the CPUs the process may run on are reported as a
+// single node.
+std::vector<std::vector<int>> CpuNodes();
+
 #endif /* THREADING_H */
 
 /*
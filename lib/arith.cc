@@ -25,6 +25,8 @@ const char *const arith_names[] = {
     "fixed64",
     "fixed128",
     "fixed256",
+    "perturbation",
+    "auto",
 };
 
 arith_type string_to_arith(const std::string &s) {
@@ -34,13 +36,95 @@ arith_type string_to_arith(const std::string &s) {
   abort();
 }
 
-int iterate(arith_t zx, arith_t zy, arith_t cx, arith_t cy, int maxiters, arith_type arith, double &r2) {
+// Every type, with the number of bits it has after the point.  Perturbation
+// is limited by the reference orbit rather than by the doubles it iterates.
+static const struct {
+  arith_type arith;
+  int bits;
+} arith_choices[] = {
+    {arith_double, 51},
+#if SIMD
+    {arith_simd, 51},
+#endif
+    {arith_long_double, 62},
+    {arith_fixed64, 56},
+    {arith_fixed128, 96},
+    {arith_fixed256, 224},
+    {arith_perturbation, 192},
+};
+
+// Errors are magnified by iteration, so a pixel must be a good many ulps.
+// With this margin, a few percent of pixels near the boundary get visibly
+// different counts from fixed256 before the next type takes over.
+static const int arith_margin = 24;
+
+// The cheapest type by arith_cost(), and of those the most precise.  At
+// present long double, fixed128 and fixed256 always lose to perturbation.
+arith_type choose_arith(double pixel) {
+  arith_type best = arith_perturbation; // nothing does better
+  int best_bits = 0;
+  for(auto &c: arith_choices) {
+    if(pixel < ldexp(1.0, arith_margin - c.bits))
+      continue;
+    if(!best_bits || arith_cost(c.arith) < arith_cost(best)
+       || (arith_cost(c.arith) == arith_cost(best) && c.bits > best_bits)) {
+      best = c.arith;
+      best_bits = c.bits;
+    }
+  }
+  return best;
+}
+
+// Measured on one core at c = 1/4 + 1e-6, where orbits take about a thousand
+// iterations to escape.  simd and perturbation are relative to double, from
+// whole images.  Only the ratios matter much: choose_arith() compares them,
+// and tile_size() uses them before it has timed anything, and to carry
+// timings across a change of type.
+double arith_cost(arith_type arith) {
+  switch(arith) {
+  case arith_double: return 4.5e-9;
+#if SIMD
+  case arith_simd: return 2e-9;
+#endif
+  case arith_long_double: return 8e-9;
+  case arith_fixed64: return 5.6e-9;
+  case arith_fixed128: return 14e-9;
+  case arith_fixed256: return 56e-9;
+  case arith_perturbation: return 8e-9;
+  default: throw std::logic_error("arith_cost unrecognized arith_t");
+  }
+}
+
+int iterate(arith_t zx,
+            arith_t zy,
+            arith_t cx,
+            arith_t cy,
+            int maxiters,
+            arith_type arith,
+            double &r2,
+            const int *cancel,
+            derivative *d,
+            bool interior) {
   switch(arith) {
-  case arith_double: return arith_traits<double>::iterate(zx, zy, cx, cy, maxiters, r2); break;
-  case arith_long_double: return arith_traits<long double>::iterate(zx, zy, cx, cy, maxiters, r2); break;
-  case arith_fixed64: return arith_traits<fixed64>::iterate(zx, zy, cx, cy, maxiters, r2); break;
-  case arith_fixed128: return arith_traits<fixed128>::iterate(zx, zy, cx, cy, maxiters, r2); break;
-  case arith_fixed256: return arith_traits<fixed256>::iterate(zx, zy, cx, cy, maxiters, r2); break;
+  case arith_double:
+    return arith_traits<double>::iterate(zx, zy, cx, cy, maxiters, r2, cancel, d, interior);
+    break;
+  case arith_long_double:
+    return arith_traits<long double>::iterate(zx, zy, cx, cy, maxiters, r2, cancel, d, interior);
+    break;
+  case arith_fixed64:
+    return arith_traits<fixed64>::iterate(zx, zy, cx, cy, maxiters, r2, cancel, d, interior);
+    break;
+  case arith_fixed128:
+    return arith_traits<fixed128>::iterate(zx, zy, cx, cy, maxiters, r2, cancel, d, interior);
+    break;
+  case arith_fixed256:
+    return arith_traits<fixed256>::iterate(zx, zy, cx, cy, maxiters, r2, cancel, d, interior);
+    break;
+  // Perturbation needs a reference orbit; without one, use full precision
+  case arith_perturbation:
+    return arith_traits<fixed256>::iterate(zx, zy, cx, cy, maxiters, r2, cancel, d, interior);
+    break;
   default: throw std::logic_error("iterate unrecognized/unsuitable arith_t");
   }
 }
@@ -18,6 +18,7 @@
 
 #include <string>
 #include <cmath>
+#include <complex>
 #include <cerrno>
 #include <cstdlib>
 #include <cassert>
@@ -41,6 +42,8 @@ enum arith_type {
   arith_fixed64,
   arith_fixed128,
   arith_fixed256,
+  arith_perturbation,
+  arith_auto, // see choose_arith()
 
   arith_limit
 };
@@ -49,12 +52,28 @@ extern const char *const arith_names[];
 
 arith_type string_to_arith(const std::string &s);
 
+// Return the cheapest arithmetic type that resolves pixels of the given size
+arith_type choose_arith(double pixel);
+
+// Rough time for one iteration of one pixel, in seconds
+double arith_cost(arith_type arith);
+
+struct derivative;
+
 template <typename T> class arith_traits {
 public:
   static T maximum();
   static std::string toString(const T &n);
   static int fromString(T &n, const char *s, char **end);
-  static int iterate(T zx, T zy, T cx, T cy, int maxiters, double &r2);
+  static int iterate(T zx,
+                     T zy,
+                     T cx,
+                     T cy,
+                     int maxiters,
+                     double &r2,
+                     const int *cancel = nullptr,
+                     derivative *d = nullptr,
+                     bool interior = false);
 };
 
 static inline count_t transform_iterations(int iterations, double r2, int maxiters) {
@@ -64,15 +83,169 @@ static inline count_t transform_iterations(int iterations, double r2, int maxite
     return 1 + iterations - log2(log2(r2));
 }
 
-template <typename T> int defaultIterate(T zx, T zy, T cx, T cy, int maxiters, double &r2_out) {
+// True if an iteration loop should give up.  *cancel is only inspected every
+// CANCEL_INTERVAL iterations.
+static inline bool iterate_cancelled(int iterations, const int *cancel) {
+  return !(iterations & (CANCEL_INTERVAL - 1)) && cancel && ATOMIC_LOAD(*cancel);
+}
+
+// Thresholds for iterate_attracted()
+const double interior_limit = 1e-12, interior_ratio = 1e-3;
+
+// Brent-style periodicity checking.  z is saved whenever the iteration count
+// reaches a power of two; if a later z is exactly equal to the saved value
+// then the orbit is periodic, so will never escape.  Every arithmetic type
+// has finitely many values, so an orbit that does not escape must eventually
+// repeat exactly.
+static inline bool iterate_checkpoint(int iterations) {
+  return !(iterations & (iterations - 1));
+}
+
+// Derivative-based interior detection, done if the iterate functions are
+// asked for it.  Write dz for the derivative of z with respect to its value
+// after the first iteration (the first z is skipped since it is 0, the
+// critical point, for the Mandelbrot set).  Once an orbit
+// is attracted to a cycle, dz shrinks geometrically; otherwise it grows.  Only
+// its magnitude matters, and |2z dz|^2 = 4|z|^2|dz|^2, so given |z|^2 it
+// costs one multiplication per iteration to track.
+//
+// dz also gets small when z passes close to 0, and shrinks like 1/n^4 while
+// an orbit lingers near a parabolic point (e.g. c=1/4) before escaping.  So
+// an orbit only counts as attracted if |dz| is small at two successive
+// checkpoints and shrank by a large factor between them.  After a close pass
+// it grows again, and near a parabolic point it only shrinks by 1/16 from one
+// checkpoint to the next.
+
+// Update dz2 = |dz|^2 given r2 = |z|^2
+static inline void iterate_derivative(int iterations, double &dz2, double r2) {
+  if(iterations)
+    dz2 *= 4 * r2;
+}
+
+// The rate of attraction of an interior orbit: the factor by which |dz|
+// shrinks per iteration, measured since the last checkpoint (whose dz2 is
+// saved_dz2).  It is 0 at the center of a component, rising to 1 at its
+// boundary.  For cycles longer than 1 it is only approximate, since the
+// number of iterations measured isn't a whole number of cycles.  The iterate
+// functions return it in place of r2 for interior points, or 1 if it is
+// unknown.
+static inline double iterate_rate(int iterations, double dz2, double saved_dz2) {
+  if(iterations < 2 || !(dz2 > 0))
+    return 0;
+  const int since = iterations - (1 << (31 - __builtin_clz(iterations - 1)));
+  const double rate = pow(dz2 / saved_dz2, 0.5 / since);
+  return rate < 1 ? rate : 1;
+}
+
+// Returns true if the orbit is attracted to a cycle, and sets rate.  Called
+// at checkpoints; saved_dz2 is dz2 at the previous one, and is updated.
+static inline bool iterate_attracted(int iterations, double dz2, double &saved_dz2, double &rate) {
+  const bool attracted = dz2 < interior_limit && saved_dz2 < interior_limit && dz2 < saved_dz2 * interior_ratio;
+  if(attracted)
+    rate = iterate_rate(iterations, dz2, saved_dz2);
+  saved_dz2 = dz2;
+  return attracted;
+}
+
+// Rates for the two components that MandelbrotJob::fastpath recognizes.  The
+// main cardioid's fixed point has multiplier 1 - sqrt(1 - 4c), and the period
+// 2 bulb's cycle has multiplier 4(c + 1).
+static inline double cardioid_rate(double cx, double cy) {
+  return std::abs(1.0 - std::sqrt(std::complex<double>(1 - 4 * cx, -4 * cy)));
+}
+
+static inline double bulb_rate(double cx, double cy) {
+  return 2 * sqrt(hypot(cx + 1, cy));
+}
+
+// Estimated distance from the set of a point that escaped with |z|^2 = r2
+// and |dz|^2 = d2, where dz is as for struct derivative
+static inline double distance_estimate(double r2, double d2) {
+  return sqrt(r2 / d2) * log(r2) / 2;
+}
+
+// The derivative of the orbit, for distance estimation.  For the Mandelbrot
+// set it is with respect to c, so it starts at 0 and gains 1 each iteration.
+// For Julia sets it is with respect to the starting point, so it starts at 1.
+// Only a double is needed whatever the arithmetic type, since only the
+// derivative's magnitude matters.
+struct derivative {
+  double x, y, add;
+  double r2 = 0; // |z|^2 after escape()
+
+  derivative(bool mandelbrot): x(mandelbrot ? 0 : 1), y(0), add(mandelbrot ? 1 : 0) {}
+
+  // Update for an iteration from z
+  inline void step(double zx, double zy) {
+    const double nx = 2 * (zx * x - zy * y) + add;
+    y = 2 * (zx * y + zy * x);
+    x = nx;
+  }
+
+  // Called when the orbit escapes at z.  The estimate is poor at R2LIMIT, so
+  // the orbit is continued a little further.
+  void escape(double zx, double zy, double cx, double cy) {
+    for(int n = 0; (r2 = zx * zx + zy * zy) < 1e12 && n < 16; ++n) {
+      step(zx, zy);
+      const double nx = zx * zx - zy * zy + cx;
+      zy = 2 * zx * zy + cy;
+      zx = nx;
+    }
+  }
+
+  // Distance estimate, after escape()
+  inline double distance() const {
+    return distance_estimate(r2, x * x + y * y);
+  }
+};
+
+// The iterate functions return the iteration count, or -1 if they gave up
+// because *cancel became nonzero.  Periodic orbits are reported as maxiters,
+// and so are those attracted to a cycle if interior is true.  r2_out is
+// |z|^2 at escape.  For interior points it is the rate (see iterate_rate())
+// if interior is true, otherwise 1.  If d is not null then it is updated at
+// each iteration (and should start as described in struct derivative), and
+// escape() is called on it if the point escapes.
+//
+// Interior detection is a heuristic, so it is only done on request.
+template <typename T>
+int defaultIterate(T zx,
+                   T zy,
+                   T cx,
+                   T cy,
+                   int maxiters,
+                   double &r2_out,
+                   const int *cancel = nullptr,
+                   derivative *d = nullptr,
+                   bool interior = false) {
   T r2, zx2, zy2;
+  T savedx = zx, savedy = zy;
+  double dz2 = 1, saved_dz2 = HUGE_VAL, rate = 1;
   int iterations = 0;
   while(((r2 = (zx2 = arith_traits<T>::square(zx)) + (zy2 = arith_traits<T>::square(zy))) < T(R2LIMIT)) && iterations < maxiters) {
+    if(interior)
+      iterate_derivative(iterations, dz2, (double)r2);
+    if(d)
+      d->step((double)zx, (double)zy);
     zy = T(2) * zx * zy + cy;
     zx = zx2 - zy2 + cx;
     ++iterations;
+    if(iterate_cancelled(iterations, cancel))
+      return -1;
+    if(zx == savedx && zy == savedy) {
+      if(interior)
+        rate = iterate_rate(iterations, dz2, saved_dz2);
+      iterations = maxiters;
+    } else if(iterate_checkpoint(iterations)) {
+      if(interior && iterate_attracted(iterations, dz2, saved_dz2, rate))
+        iterations = maxiters;
+      savedx = zx;
+      savedy = zy;
+    }
   }
-  r2_out = (double)r2;
+  if(d && iterations < maxiters)
+    d->escape((double)zx, (double)zy, (double)cx, (double)cy);
+  r2_out = iterations == maxiters ? rate : (double)r2;
   assert(r2_out >= 0.0);
   return iterations;
 }
@@ -99,8 +272,16 @@ public:
     return errno;
   }
 
-  static int iterate(arith_t zx, arith_t zy, arith_t cx, arith_t cy, int maxiters, double &r2) {
-    return defaultIterate((double)zx, (double)zy, (double)cx, (double)cy, maxiters, r2);
+  static int iterate(arith_t zx,
+                     arith_t zy,
+                     arith_t cx,
+                     arith_t cy,
+                     int maxiters,
+                     double &r2,
+                     const int *cancel = nullptr,
+                     derivative *d = nullptr,
+                     bool interior = false) {
+    return defaultIterate((double)zx, (double)zy, (double)cx, (double)cy, maxiters, r2, cancel, d, interior);
   }
 };
 
@@ -131,8 +312,17 @@ public:
     return errno;
   }
 
-  static int iterate(arith_t zx, arith_t zy, arith_t cx, arith_t cy, int maxiters, double &r2) {
-    return defaultIterate((long double)zx, (long double)zy, (long double)cx, (long double)cy, maxiters, r2);
+  static int iterate(arith_t zx,
+                     arith_t zy,
+                     arith_t cx,
+                     arith_t cy,
+                     int maxiters,
+                     double &r2,
+                     const int *cancel = nullptr,
+                     derivative *d = nullptr,
+                     bool interior = false) {
+    return defaultIterate(
+        (long double)zx, (long double)zy, (long double)cx, (long double)cy, maxiters, r2, cancel, d, interior);
   }
 };
 
@@ -155,8 +345,18 @@ public:
     return n.fromString(s, endptr);
   }
 
-  static int iterate(fixed256 zx, fixed256 zy, fixed256 cx, fixed256 cy, int maxiters, double &r2_out) {
+  static int iterate(fixed256 zx,
+                     fixed256 zy,
+                     fixed256 cx,
+                     fixed256 cy,
+                     int maxiters,
+                     double &r2_out,
+                     const int *cancel = nullptr,
+                     derivative *d = nullptr,
+                     bool interior = false) {
     Fixed256 r2, zx2, zy2;
+    Fixed256 savedx = zx.f, savedy = zy.f;
+    double dz2 = 1, saved_dz2 = HUGE_VAL, rate = 1;
     int iterations = 0;
     Fixed256 limit;
     Fixed256_int2(&limit, R2LIMIT);
@@ -166,14 +366,32 @@ public:
       Fixed256_add(&r2, &zx2, &zy2);
       if(Fixed256_ge(&r2, &limit) || iterations >= maxiters)
         break;
+      if(interior)
+        iterate_derivative(iterations, dz2, Fixed256_2double(&r2));
+      if(d)
+        d->step(Fixed256_2double(&zx.f), Fixed256_2double(&zy.f));
       Fixed256_mul(&zy.f, &zx.f, &zy.f);
       Fixed256_add(&zy.f, &zy.f, &zy.f);
       Fixed256_add(&zy.f, &zy.f, &cy.f);
       Fixed256_sub(&zx.f, &zx2, &zy2);
       Fixed256_add(&zx.f, &zx.f, &cx.f);
       ++iterations;
+      if(iterate_cancelled(iterations, cancel))
+        return -1;
+      if(Fixed256_eq(&zx.f, &savedx) && Fixed256_eq(&zy.f, &savedy)) {
+        if(interior)
+          rate = iterate_rate(iterations, dz2, saved_dz2);
+        iterations = maxiters;
+      } else if(iterate_checkpoint(iterations)) {
+        if(interior && iterate_attracted(iterations, dz2, saved_dz2, rate))
+          iterations = maxiters;
+        savedx = zx.f;
+        savedy = zy.f;
+      }
     }
-    r2_out = Fixed256_2double(&r2);
+    if(d && iterations < maxiters)
+      d->escape(Fixed256_2double(&zx.f), Fixed256_2double(&zy.f), Fixed256_2double(&cx.f), Fixed256_2double(&cy.f));
+    r2_out = iterations == maxiters ? rate : Fixed256_2double(&r2);
     return iterations;
   }
 };
@@ -199,14 +417,28 @@ public:
     return n.fromString(s, endptr);
   }
 
-  static int iterate(fixed128 zx, fixed128 zy, fixed128 cx, fixed128 cy, int maxiters, double &r2_out) {
+  static int iterate(fixed128 zx,
+                     fixed128 zy,
+                     fixed128 cx,
+                     fixed128 cy,
+                     int maxiters,
+                     double &r2_out,
+                     const int *cancel = nullptr,
+                     derivative *d = nullptr,
+                     bool interior = false) {
 #if HAVE_ASM_FIXED128_ITERATE
-    int rawCount = Fixed128_iterate(&zx.f, &zy.f, &cx.f, &cy.f, maxiters);
-    // r2 is returned in zx (rather oddly)
-    r2_out = (double)zx;
-    return rawCount;
-#else
+    // The assembler version doesn't do derivatives
+    if(!d && !interior) {
+      int rawCount = Fixed128_iterate(&zx.f, &zy.f, &cx.f, &cy.f, maxiters, cancel);
+      // r2 is returned in zx (rather oddly).  The rate of interior points
+      // isn't known.
+      r2_out = rawCount == maxiters ? 1 : (double)zx;
+      return rawCount;
+    }
+#endif
     Fixed128 r2, zx2, zy2;
+    Fixed128 savedx = zx.f, savedy = zy.f;
+    double dz2 = 1, saved_dz2 = HUGE_VAL, rate = 1;
     int iterations = 0;
     Fixed128 limit;
     Fixed128_int2(&limit, R2LIMIT);
@@ -216,16 +448,33 @@ public:
       Fixed128_add(&r2, &zx2, &zy2);
       if(Fixed128_ge(&r2, &limit) || iterations >= maxiters)
         break;
+      if(interior)
+        iterate_derivative(iterations, dz2, Fixed128_2double(&r2));
+      if(d)
+        d->step(Fixed128_2double(&zx.f), Fixed128_2double(&zy.f));
       Fixed128_mul(&zy.f, &zx.f, &zy.f);
       Fixed128_add(&zy.f, &zy.f, &zy.f);
       Fixed128_add(&zy.f, &zy.f, &cy.f);
       Fixed128_sub(&zx.f, &zx2, &zy2);
       Fixed128_add(&zx.f, &zx.f, &cx.f);
       ++iterations;
+      if(iterate_cancelled(iterations, cancel))
+        return -1;
+      if(Fixed128_eq(&zx.f, &savedx) && Fixed128_eq(&zy.f, &savedy)) {
+        if(interior)
+          rate = iterate_rate(iterations, dz2, saved_dz2);
+        iterations = maxiters;
+      } else if(iterate_checkpoint(iterations)) {
+        if(interior && iterate_attracted(iterations, dz2, saved_dz2, rate))
+          iterations = maxiters;
+        savedx = zx.f;
+        savedy = zy.f;
+      }
     }
-    r2_out = Fixed128_2double(&r2);
+    if(d && iterations < maxiters)
+      d->escape(Fixed128_2double(&zx.f), Fixed128_2double(&zy.f), Fixed128_2double(&cx.f), Fixed128_2double(&cy.f));
+    r2_out = iterations == maxiters ? rate : Fixed128_2double(&r2);
     return iterations;
-#endif
   }
 };
 
@@ -249,17 +498,39 @@ public:
     return n.fromString(s, endptr);
   }
 
-  static int iterate(arith_t zxa, arith_t zya, arith_t cxa, arith_t cya, int maxiters, double &r2_out) {
+  static int iterate(arith_t zxa,
+                     arith_t zya,
+                     arith_t cxa,
+                     arith_t cya,
+                     int maxiters,
+                     double &r2_out,
+                     const int *cancel = nullptr,
+                     derivative *d = nullptr,
+                     bool interior = false) {
     fixed64 zx = zxa, zy = zya, cx = cxa, cy = cya;
 #if HAVE_ASM_FIXED64_ITERATE || 0
-    return Fixed64_iterate(zx.f, zy.f, cx.f, cy.f, &r2_out, maxiters);
-#else
-    return defaultIterate(zx, zy, cx, cy, maxiters, r2_out);
+    // The assembler version doesn't do derivatives
+    if(!d && !interior) {
+      const int count = Fixed64_iterate(zx.f, zy.f, cx.f, cy.f, &r2_out, maxiters, cancel);
+      if(count == maxiters)
+        r2_out = 1; // rate unknown
+      return count;
+    }
 #endif
+    return defaultIterate(zx, zy, cx, cy, maxiters, r2_out, cancel, d, interior);
   }
 };
 
-int iterate(arith_t zx, arith_t zy, arith_t cx, arith_t cy, int maxiters, arith_type arith, double &r2);
+int iterate(arith_t zx,
+            arith_t zy,
+            arith_t cx,
+            arith_t cy,
+            int maxiters,
+            arith_type arith,
+            double &r2,
+            const int *cancel = nullptr,
+            derivative *d = nullptr,
+            bool interior = false);
 
 #endif /* ARITH_H */
 
@@ -44,7 +44,10 @@ int main(int argc, char **argv) {
   int maxiter = 20000;
   if(argc > 1)
     maxiter = atoi(argv[1]);
-  double zxvalues[SIMD] = {0}, zyvalues[SIMD] = {0}, cxvalues[SIMD] = {0}, cyvalues[SIMD] = {0}, r2values[SIMD] = {0};
+  // c=-1.9 never escapes but its orbit is chaotic, so periodicity checking
+  // doesn't cut the loop short
+  double zxvalues[SIMD] = {0}, zyvalues[SIMD] = {0}, cxvalues[SIMD] = {SIMD_REP(-1.9)}, cyvalues[SIMD] = {0},
+         r2values[SIMD] = {0};
   int iterations[SIMD];
   unsigned long long start = CYCLES();
   simd_iterate(zxvalues, zyvalues, cxvalues, cyvalues, maxiter, iterations, r2values, 0);
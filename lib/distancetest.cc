@@ -0,0 +1,108 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "arith.h"
+#include "simdarith.h"
+#include "ReferenceOrbit.h"
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static const int maxiters = 1000;
+
+// Check the distance estimate for z0 = zx + izy escaping under c = cx + icy
+// is between low and high, using every arithmetic type
+static void check_point(bool mandelbrot, double zx, double zy, double cx, double cy, double low, double high) {
+  for(int a = 0; a < arith_limit; ++a) {
+    double r2, distance;
+    int iterations;
+    switch(a) {
+    case arith_simd: {
+#if SIMD
+      const double zxvalues[SIMD] = {SIMD_REP(zx)}, zyvalues[SIMD] = {SIMD_REP(zy)};
+      const double cxvalues[SIMD] = {SIMD_REP(cx)}, cyvalues[SIMD] = {SIMD_REP(cy)};
+      double r2values[SIMD], distances[SIMD];
+      int itervalues[SIMD];
+      simd_iterate(zxvalues, zyvalues, cxvalues, cyvalues, maxiters, itervalues, r2values, mandelbrot, nullptr,
+                   distances);
+      iterations = itervalues[0];
+      r2 = r2values[0];
+      distance = distances[0];
+      break;
+#else
+      continue;
+#endif
+    }
+    case arith_perturbation: {
+      // Perturb from a nearby reference so that the derivative of the
+      // perturbation is exercised, in both the scalar and SIMD versions
+      ReferenceOrbit *reference =
+          new ReferenceOrbit(arith_t(zx * 0.999), arith_t(zy), arith_t(cx * 0.999), arith_t(cy), maxiters, !mandelbrot);
+      derivative d(mandelbrot);
+      const double dzx = mandelbrot ? 0 : zx - (double)reference->zx0, dcx = mandelbrot ? cx - (double)reference->cx : 0;
+      iterations = reference->iterate(dzx, 0, dcx, 0, maxiters, r2, nullptr, 0, &d);
+      distance = d.distance();
+#if SIMD
+      const double dzxvalues[SIMD] = {SIMD_REP(dzx)}, dcxvalues[SIMD] = {SIMD_REP(dcx)}, zero[SIMD] = {SIMD_REP(0)};
+      double r2values[SIMD], distances[SIMD];
+      int itervalues[SIMD];
+      reference->simd_iterate(dzxvalues, zero, dcxvalues, zero, maxiters, itervalues, r2values, nullptr, 0, distances);
+      printf("%s simd %g%+gi %g%+gi: %d iterations, distance %g\n", arith_names[a], zx, zy, cx, cy, itervalues[0],
+             distances[0]);
+      ASSERT(itervalues[0] == iterations);
+      ASSERT(distances[0] >= low && distances[0] <= high);
+#endif
+      reference->release();
+      break;
+    }
+    case arith_auto: continue;
+    default: {
+      derivative d(mandelbrot);
+      iterations = iterate(arith_t(zx), arith_t(zy), arith_t(cx), arith_t(cy), maxiters, (arith_type)a, r2, nullptr, &d);
+      distance = d.distance();
+      break;
+    }
+    }
+    printf("%s %g%+gi %g%+gi: %d iterations, distance %g\n", arith_names[a], zx, zy, cx, cy, iterations, distance);
+    ASSERT(iterations < maxiters);
+    ASSERT(distance >= low && distance <= high);
+  }
+}
+
+int main() {
+  // For c = 0 the Julia set is the unit circle, and the estimate is exactly
+  // |z0| log |z0|
+  check_point(false, 2, 0, 0, 0, 2 * log(2) - 1e-9, 2 * log(2) + 1e-9);
+  check_point(false, -1.5, 0, 0, 0, 1.5 * log(1.5) - 1e-9, 1.5 * log(1.5) + 1e-9);
+  // The nearest point of the Mandelbrot set to c < -2 is -2.  The estimate
+  // is within a factor of 4 of the true distance.
+  check_point(true, 0, 0, -2.1, 0, 0.1 / 4, 0.1 * 4);
+  check_point(true, 0, 0, -2.001, 0, 0.001 / 4, 0.001 * 4);
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -38,6 +38,20 @@ void fatal(int errno_value, const char *fmt, ...) {
   exit(1);
 }
 
+/* Report a problem that the program can carry on from.
+ *
+ * The format strings and additional arguments follow the same rules as printf.
+ */
+void warning(const char *fmt, ...) {
+  va_list ap;
+
+  fprintf(stderr, "WARNING: ");
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -470,7 +470,7 @@ int main() {
                 "0104166666666666666666666666708739248278453962955292190148"
                 "41526558257100987248122692108154296875");
   putchar('\n');
-  count = Fixed128_iterate(&a, &b, &c, &d, 255);
+  count = Fixed128_iterate(&a, &b, &c, &d, 255, NULL);
   printf("iterate: %d\n", count);
   assert(count == 4);
   printf("r2:      ");
@@ -488,7 +488,7 @@ int main() {
   printf("cy:      ");
   printFixed128(&d, "-1");
   putchar('\n');
-  count = Fixed128_iterate(&a, &b, &c, &d, 255);
+  count = Fixed128_iterate(&a, &b, &c, &d, 255, NULL);
   if(count != 3) {
     printf("-- EXPECTED 3\n");
     ++errors;
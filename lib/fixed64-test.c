@@ -321,7 +321,7 @@ int main() {
   printf("cy:      ");
   printFixed(cy, "-0.01041666666666667129259593593815225176513195037841796875");
   putchar('\n');
-  count = Fixed64_iterate(0, 0, cx, cy, &r2, 255);
+  count = Fixed64_iterate(0, 0, cx, cy, &r2, 255, NULL);
   printf("iterate: %d   r2: %.32g\n", count, r2);
   assert(count == 4);
   assert(r2 ==  15.323603744876644228156692406628);
@@ -334,7 +334,7 @@ int main() {
   printf("cy:      ");
   printFixed(cy, "-1");
   putchar('\n');
-  count = Fixed64_iterate(0, 0, cx, cy, &r2, 255);
+  count = Fixed64_iterate(0, 0, cx, cy, &r2, 255, NULL);
   printf("iterate: %d   r2: %.32g\n", count, r2);
   if(count != 3) {
     printf("-- EXPECTED iterate 3\n");
@@ -0,0 +1,89 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include <cstring>
+#include <ctime>
+
+static long long evaluated;
+
+static void completed(Job *job, void *) {
+  evaluated += static_cast<FractalJob *>(job)->evaluated;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// Render a sequence of frames from one factory, the way RenderMovie does, and
+// report frame latency, the proportion of pixels actually computed and job
+// allocations
+int main(int argc, char **argv) {
+  int width = 3840, height = 2160, maxiters = 64, frames = 25, nthreads = -1;
+  arith_type arith = ARITH_DEFAULT;
+  if(argc > 1)
+    width = atoi(argv[1]);
+  if(argc > 2)
+    height = atoi(argv[2]);
+  if(argc > 3)
+    maxiters = atoi(argv[3]);
+  if(argc > 4)
+    frames = atoi(argv[4]);
+  if(argc > 5)
+    nthreads = atoi(argv[5]);
+  if(argc > 6)
+    arith = string_to_arith(argv[6]);
+  MandelbrotJobFactory jf;
+  if(argc > 7) {
+    int s;
+    for(s = 0; s < strategy_limit; ++s)
+      if(!strcmp(strategy_names[s], argv[7]))
+        break;
+    if(s == strategy_limit)
+      fatal(0, "unknown strategy '%s'", argv[7]);
+    jf.strategy = render_strategy(s);
+  }
+  Job::init(nthreads);
+  double total = 0, worst = 0;
+  for(int frame = 0; frame < frames; ++frame) {
+    arith_t radius = 2 * pow(0.9, frame);
+    double begin = now();
+    IterBuffer *dest =
+        FractalJob::recompute(-0.75, 0.1, radius, maxiters, width, height, arith, completed, &jf, 0, 0, &jf);
+    Job::poll(&jf);
+    double elapsed = now() - begin;
+    dest->release();
+    total += elapsed;
+    worst = std::max(worst, elapsed);
+  }
+  Job::destroy();
+  printf("%dx%d maxiters %d %s %s: %d frames; mean %.4fs; worst %.4fs; %.1f%% of pixels computed; %zu jobs allocated, %zu "
+         "reused\n",
+         width,
+         height,
+         maxiters,
+         arith_names[arith],
+         strategy_names[jf.strategy],
+         frames,
+         total / frames,
+         worst,
+         100.0 * evaluated / ((double)width * height * frames),
+         jf.allocated(),
+         jf.reused());
+  return 0;
+}
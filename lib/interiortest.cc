@@ -0,0 +1,146 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "arith.h"
+#include "simdarith.h"
+#include "ReferenceOrbit.h"
+#include "MandelbrotJob.h"
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static const int maxiters = 100000;
+
+// Check the result of iterating c.  expected is the rate (see
+// iterate_rate()), to within tolerance, or -1 if c escapes.
+static void check(
+    const char *what, double cx, double cy, double expected, double tolerance, int iterations, double r2) {
+  printf("%s %g%+gi: %d iterations, r2 %g\n", what, cx, cy, iterations, r2);
+  if(expected < 0)
+    ASSERT(iterations < maxiters);
+  else {
+    ASSERT(iterations == maxiters);
+    ASSERT(fabs(r2 - expected) <= tolerance);
+  }
+}
+
+static void check_point(double cx, double cy, double expected, double tolerance = 1e-6) {
+  for(int a = 0; a < arith_limit; ++a) {
+    double r2;
+    int iterations;
+    switch(a) {
+#if SIMD
+    case arith_simd: {
+      const double zero[SIMD] = {SIMD_REP(0)}, cxvalues[SIMD] = {SIMD_REP(cx)}, cyvalues[SIMD] = {SIMD_REP(cy)};
+      double r2values[SIMD];
+      int itervalues[SIMD];
+      simd_iterate(zero, zero, cxvalues, cyvalues, maxiters, itervalues, r2values, 0, nullptr, nullptr, true);
+      iterations = itervalues[0];
+      r2 = r2values[0];
+      break;
+    }
+#endif
+    case arith_perturbation: {
+      ReferenceOrbit *reference = new ReferenceOrbit(0, 0, arith_t(cx), arith_t(cy), maxiters, false);
+      iterations = reference->iterate(0, 0, 0, 0, maxiters, r2, nullptr, 0, nullptr, true);
+      reference->release();
+      break;
+    }
+    case arith_auto: continue;
+    default:
+      iterations = iterate(0, 0, arith_t(cx), arith_t(cy), maxiters, (arith_type)a, r2, nullptr, nullptr, true);
+      break;
+    }
+    check(arith_names[a], cx, cy, expected, tolerance, iterations, r2);
+  }
+}
+
+static void completed(Job *, void *) {}
+
+static IterBuffer *render(MandelbrotJobFactory &jf, double x, double y, double r, int iterations, arith_type arith) {
+  IterBuffer *dest =
+      FractalJob::recompute(arith_t(x), arith_t(y), arith_t(r), iterations, 64, 48, arith, completed, &jf, 0, 0, &jf);
+  Job::poll(&jf);
+  return dest;
+}
+
+// Interior detection must only change how quickly interior points are found,
+// never the image
+static void compare(double x, double y, double r, int iterations, arith_type arith) {
+  MandelbrotJobFactory plain, detecting;
+  detecting.interior = true;
+  // The assembler versions are only used without interior detection, and
+  // don't round quite like the C ones, so make both renders use the C ones
+  if(arith == arith_fixed64 || arith == arith_fixed128)
+    plain.distances = detecting.distances = true;
+  IterBuffer *expected = render(plain, x, y, r, iterations, arith);
+  IterBuffer *got = render(detecting, x, y, r, iterations, arith);
+  int wrong = 0, interior = 0;
+  for(int py = 0; py < expected->height(); ++py)
+    for(int px = 0; px < expected->width(); ++px) {
+      if(fabs(got->pixel(px, py) - expected->pixel(px, py)) > 0.01)
+        ++wrong;
+      if(expected->pixel(px, py) >= iterations)
+        ++interior;
+    }
+  printf("%s %g%+gi r=%g: %d/%d pixels differ, %d interior\n", arith_names[arith], x, y, r, wrong,
+         expected->width() * expected->height(), interior);
+  ASSERT(wrong == 0);
+  // The view must have some interior, otherwise the test proves nothing
+  ASSERT(interior > 0 && interior < expected->width() * expected->height());
+  expected->release();
+  got->release();
+}
+
+int main() {
+  // The two components with known rates
+  check_point(-0.1, 0.1, cardioid_rate(-0.1, 0.1));
+  check_point(-1.05, 0.05, bulb_rate(-1.05, 0.05));
+  // Near the center of the period-3 bulb.  The true rate is 0.0914, but it's
+  // measured over a number of iterations that isn't a whole number of
+  // cycles.
+  check_point(-0.1225, 0.7449, 0.0914, 0.05);
+  // Escapes after lingering near a parabolic point, where dz gets small
+  check_point(0.2500001, 0, -1);
+  check_point(-0.75, 0.0005, -1);
+  // Never escapes, but chaotic, so the rate is unknown
+  check_point(-1.9, 0, 1, 0);
+  Job::init(1);
+  for(int a = 0; a < arith_limit; ++a) {
+    if(a == arith_auto)
+      continue;
+    // The whole set; the cusp of the main cardioid and seahorse valley, where
+    // orbits linger near parabolic points before escaping
+    compare(-0.75, 0, 1.5, 1000, (arith_type)a);
+    compare(0.25, 0, 0.001, 10000, (arith_type)a);
+    compare(-0.75, 0.05, 0.05, 3000, (arith_type)a);
+  }
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
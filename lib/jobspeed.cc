@@ -0,0 +1,67 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include <ctime>
+#include <unistd.h>
+
+static int tiles;
+
+static void completed(Job *, void *) {
+  ++tiles;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// Measure tile throughput of the job pool as the number of threads varies
+int main(int argc, char **argv) {
+  int width = 2048, height = 2048, maxiters = 1024, maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(argc > 1)
+    width = atoi(argv[1]);
+  if(argc > 2)
+    height = atoi(argv[2]);
+  if(argc > 3)
+    maxiters = atoi(argv[3]);
+  if(argc > 4)
+    maxthreads = atoi(argv[4]);
+  MandelbrotJobFactory jf;
+  double base = 0;
+  for(int nthreads = 1; nthreads <= maxthreads; ++nthreads) {
+    Job::init(nthreads);
+    tiles = 0;
+    double begin = now();
+    IterBuffer *dest =
+        FractalJob::recompute(-0.5, 0, 1.25, maxiters, width, height, ARITH_DEFAULT, completed, &jf, 0, 0, &jf);
+    Job::poll(&jf);
+    double seconds = now() - begin;
+    dest->release();
+    Job::destroy();
+    double tps = tiles / seconds;
+    if(nthreads == 1)
+      base = tps;
+    printf("%3d threads %8d tiles; %10.0f tiles/second; speedup %5.2f (elapsed %3.2fs)\n",
+           nthreads,
+           tiles,
+           tps,
+           tps / base,
+           seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,191 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "Job.h"
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <sched.h>
+#include <unistd.h>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static ATOMIC_TYPE batch_started; // batch jobs that have started work
+static int batch_seen;            // most batch jobs started before any interactive job
+static ATOMIC_TYPE live;          // jobs not yet recycled
+static ATOMIC_TYPE worked;        // jobs that have finished work
+static int delivered;             // completions delivered to counted()
+
+// Stands in for a tile: a small, fixed amount of work
+class TileJob: public Job {
+public:
+  TileJob(bool interactive_): interactive(interactive_) {
+    ATOMIC_INC(live);
+  }
+  ~TileJob() {
+    ATOMIC_DEC(live);
+  }
+  bool interactive;
+  int seen = 0;
+
+  void work() {
+    if(interactive)
+      seen = ATOMIC_GET(batch_started);
+    else
+      ATOMIC_INC(batch_started);
+    volatile int n = 0;
+    while(n < 20000)
+      n = n + 1;
+    ATOMIC_INC(worked);
+  }
+};
+
+static void completed(Job *job, void *) {
+  TileJob *t = static_cast<TileJob *>(job);
+  if(t->seen > batch_seen)
+    batch_seen = t->seen;
+}
+
+static void counted(Job *, void *) {
+  ++delivered;
+}
+
+#if HAVE_SCHED_GETAFFINITY && HAVE_PTHREAD_SETAFFINITY_NP
+// Records whether it ran outside the CPUs in allowed
+class AffinityJob: public Job {
+public:
+  static cpu_set_t allowed;
+  bool outside = false;
+
+  void work() {
+    cpu_set_t set;
+    if(sched_getaffinity(0, sizeof set, &set) < 0)
+      fatal(errno, "sched_getaffinity");
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if(CPU_ISSET(cpu, &set) && !CPU_ISSET(cpu, &allowed))
+        outside = true;
+  }
+};
+
+cpu_set_t AffinityJob::allowed;
+
+static int outside; // AffinityJobs that ran outside their CPUs
+
+static void checked(Job *job, void *) {
+  if(static_cast<AffinityJob *>(job)->outside)
+    ++outside;
+}
+
+// Placed workers must stay within the CPUs that the process was given
+static void check_placement(job_placement placement) {
+  cpu_set_t set;
+  if(sched_getaffinity(0, sizeof set, &set) < 0)
+    fatal(errno, "sched_getaffinity");
+  CPU_ZERO(&AffinityJob::allowed);
+  for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    if(CPU_ISSET(cpu, &set)) {
+      CPU_SET(cpu, &AffinityJob::allowed);
+      break;
+    }
+  if(sched_setaffinity(0, sizeof AffinityJob::allowed, &AffinityJob::allowed) < 0)
+    fatal(errno, "sched_setaffinity");
+  Job::init(4, placement);
+  ASSERT(Job::placement() == placement);
+  int affinity;
+  outside = 0;
+  for(int n = 0; n < 64; ++n)
+    (new AffinityJob())->submit(checked, &affinity);
+  Job::poll(&affinity);
+  Job::destroy();
+  if(sched_setaffinity(0, sizeof set, &set) < 0)
+    fatal(errno, "sched_setaffinity");
+  printf("%s placement: %d jobs ran outside the process's CPUs\n", placement_names[placement], outside);
+  ASSERT(outside == 0);
+}
+#endif
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main() {
+  const int nthreads = 4;
+  int movie, view;
+  Job::init(nthreads);
+  // Queue up a long movie render
+  for(int n = 0; n < 2000 * nthreads; ++n)
+    (new TileJob(false))->submit(completed, &movie, job_batch);
+  // Then redraw the view
+  double begin = now();
+  for(int n = 0; n < 64; ++n)
+    (new TileJob(true))->submit(completed, &view, job_interactive);
+  int started = ATOMIC_GET(batch_started);
+  Job::poll(&view);
+  double latency = now() - begin;
+  // The movie must still be going, otherwise the test proves nothing
+  ASSERT(Job::pending(&movie));
+  // Only batch jobs that were already taken can have started since the view
+  // jobs were submitted
+  ASSERT(batch_seen <= started + nthreads);
+  printf("interactive latency %.3fs; batch jobs started %d before, at most %d during\n",
+         latency,
+         started,
+         batch_seen - started);
+  Job::cancel(&movie);
+  Job::poll(&movie);
+  // Cancelled jobs must all have been recycled by now
+  ASSERT(!Job::pending(&movie));
+  ASSERT(ATOMIC_GET(live) == 0);
+  // A poll(int) that delivers only some completions must not leave the rest
+  // where poll(void *) can't find them
+  int partial;
+  const int npartial = 300;
+  const int before = ATOMIC_GET(worked);
+  for(int n = 0; n < npartial; ++n)
+    (new TileJob(true))->submit(counted, &partial, job_interactive);
+  while(ATOMIC_GET(worked) < before + npartial)
+    ;
+  alarm(10);
+  ASSERT(Job::poll(16));
+  ASSERT(delivered == 16);
+  Job::poll(&partial);
+  alarm(0);
+  ASSERT(delivered == npartial);
+  ASSERT(!Job::pending(&partial));
+  ASSERT(!Job::poll(16));
+  ASSERT(ATOMIC_GET(live) == 0);
+  Job::destroy();
+#if HAVE_SCHED_GETAFFINITY && HAVE_PTHREAD_SETAFFINITY_NP
+  check_placement(placement_cores);
+  check_placement(placement_nodes);
+#endif
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -43,17 +43,16 @@
 #define SIMD_REP(n) n, n, n, n
 #endif
 
-#if SIMD
-#define ARITH_DEFAULT arith_simd
-#else
-#define ARITH_DEFAULT arith_double
-#endif
+#define ARITH_DEFAULT arith_auto
 
 #if __GNUC__ && !defined ATOMIC_INC
 #define ATOMIC_INC(x) __sync_add_and_fetch(&(x), 1)
 #define ATOMIC_DEC(x) __sync_sub_and_fetch(&(x), 1)
 #define ATOMIC_SET(x) __sync_or_and_fetch(&(x), 1)
 #define ATOMIC_GET(x) __sync_fetch_and_or(&(x), 0)
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ATOMIC_CAS(x, old, new) __sync_bool_compare_and_swap(&(x), (old), (new))
+#define ATOMIC_EXCHANGE(x, v) __atomic_exchange_n(&(x), (v), __ATOMIC_SEQ_CST)
 #endif
 
 #include "Fixed128.h"
@@ -61,6 +60,7 @@
 typedef double count_t;
 
 void fatal(int errno_value, const char *fmt, ...) attribute((format(printf, 2, 3))) attribute((noreturn));
+void warning(const char *fmt, ...) attribute((format(printf, 1, 2)));
 
 #endif /* MANDY_H */
 
@@ -0,0 +1,191 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include "JuliaJob.h"
+#include "ReferenceOrbit.h"
+#include <cstdio>
+#include <ctime>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static int delivered; // completion callbacks called
+
+static void completed(Job *, void *) {
+  ++delivered;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static IterBuffer *render(
+    FractalJobFactory &jf, const char *x, const char *y, const char *r, int maxiters, arith_type arith) {
+  arith_t cx, cy, radius;
+  char *end;
+  arith_traits<arith_t>::fromString(cx, x, &end);
+  arith_traits<arith_t>::fromString(cy, y, &end);
+  arith_traits<arith_t>::fromString(radius, r, &end);
+  IterBuffer *dest = FractalJob::recompute(cx, cy, radius, maxiters, 64, 48, arith, completed, &jf, 0, 0, &jf);
+  Job::poll(&jf);
+  return dest;
+}
+
+// Compare perturbation with full precision.  A few chaotic pixels are
+// allowed to come out differently.
+static void compare(FractalJobFactory &jf, const char *x, const char *y, const char *r, int maxiters) {
+  IterBuffer *perturbed = render(jf, x, y, r, maxiters, arith_perturbation);
+  IterBuffer *exact = render(jf, x, y, r, maxiters, arith_fixed256);
+  int wrong = 0, escaped = 0;
+  for(int py = 0; py < exact->height(); ++py)
+    for(int px = 0; px < exact->width(); ++px) {
+      if(fabs(perturbed->pixel(px, py) - exact->pixel(px, py)) > 0.01)
+        ++wrong;
+      if(exact->pixel(px, py) < maxiters)
+        ++escaped;
+    }
+  printf("%s %s %s: %d/%d pixels differ, %d escaped\n", x, y, r, wrong, exact->width() * exact->height(), escaped);
+  ASSERT(wrong * 100 < exact->width() * exact->height());
+  // The view must have some structure, otherwise the test proves nothing
+  ASSERT(escaped > 0 && escaped < exact->width() * exact->height());
+  perturbed->release();
+  exact->release();
+}
+
+// Check the series approximation against the perturbation recurrence it
+// replaces
+static void check_series(const char *x, const char *y, double d, int maxiters) {
+  arith_t cx, cy;
+  char *end;
+  arith_traits<arith_t>::fromString(cx, x, &end);
+  arith_traits<arith_t>::fromString(cy, y, &end);
+  ReferenceOrbit *reference = new ReferenceOrbit(0, 0, cx, cy, maxiters, false);
+  const int skip = reference->skippable(cx - arith_t(d), cy - arith_t(d), cx + arith_t(d), cy + arith_t(d));
+  double dzx = 0, dzy = 0;
+  for(int n = 0; n < skip; ++n) {
+    const double tx = 2 * reference->zx[n] + dzx, ty = 2 * reference->zy[n] + dzy;
+    const double nx = tx * dzx - ty * dzy + d;
+    dzy = tx * dzy + ty * dzx + d;
+    dzx = nx;
+  }
+  double sx, sy;
+  reference->approximate(skip, d, d, sx, sy);
+  const double error = hypot(sx - dzx, sy - dzy) / hypot(dzx, dzy);
+  printf("%s %s %g: skip %d, relative error %g\n", x, y, d, skip, error);
+  ASSERT(skip > 0);
+  ASSERT(error < 1e-6);
+  reference->release();
+}
+
+// A pan that keeps the reference point in view reuses the orbit.  A zoom, or
+// a pan that loses the point, doesn't.
+static void check_reuse() {
+  MandelbrotJobFactory jf;
+  const arith_t x(-0.74364388), y(0.13182590), r(1e-6);
+  IterBuffer *dest = FractalJob::recompute(x, y, r, 3000, 64, 48, arith_perturbation, completed, &jf, 0, 0, &jf);
+  Job::poll(&jf);
+  dest->release();
+  ReferenceOrbit *first = jf.kept_reference(x, y, r, 64, 48, 3000);
+  ASSERT(first != nullptr);
+  const arith_t panned = x + r / 2;
+  dest = FractalJob::recompute(panned, y, r, 3000, 64, 48, arith_perturbation, completed, &jf, 0, 0, &jf);
+  Job::poll(&jf);
+  dest->release();
+  ReferenceOrbit *second = jf.kept_reference(panned, y, r, 64, 48, 3000);
+  ASSERT(second == first);
+  ASSERT(jf.kept_reference(x, y, r / 2, 64, 48, 3000) == nullptr);
+  ASSERT(jf.kept_reference(x + r * 3, y, r, 64, 48, 3000) == nullptr);
+  ASSERT(jf.kept_reference(x, y, r, 64, 48, 4000) == nullptr);
+  if(first)
+    first->release();
+  if(second)
+    second->release();
+}
+
+// Cancelling a view must stop its reference orbit too
+static void check_cancel() {
+  MandelbrotJobFactory jf;
+  const arith_t x(-0.1), y(0.1), r(1e-20);
+  const int maxiters = 100000000; // interior, so the orbit takes several seconds
+  delivered = 0;
+  const double begin = now();
+  IterBuffer *dest = FractalJob::recompute(x, y, r, maxiters, 64, 48, arith_perturbation, completed, &jf, 0, 0, &jf);
+  const double submitted = now() - begin;
+  struct timespec delay = {0, 50000000};
+  nanosleep(&delay, nullptr); // let the orbit start
+  Job::cancel(&jf);
+  Job::poll(&jf);
+  const double elapsed = now() - begin;
+  dest->release();
+  printf("cancelled orbit: recompute %.4fs, total %.3fs\n", submitted, elapsed);
+  ASSERT(submitted < 0.01);
+  ASSERT(elapsed < 1);
+  ASSERT(delivered == 0);
+  ASSERT(jf.kept_reference(x, y, r, 64, 48, maxiters) == nullptr);
+}
+
+// The type that arith_auto resolves to for a 640x480 view of radius r
+static void check_auto(double r, arith_type expected) {
+  const arith_type chosen = choose_arith((double)FractalJob::pixel_size(arith_t(r), 640, 480));
+  printf("auto at radius %g: %s\n", r, arith_names[chosen]);
+  ASSERT(chosen == expected);
+}
+
+int main() {
+  Job::init(1);
+#if SIMD
+  check_auto(2, arith_simd);
+  check_auto(1e-4, arith_simd);
+#else
+  check_auto(2, arith_double);
+  check_auto(1e-4, arith_double);
+#endif
+  check_auto(1e-6, arith_fixed64);
+  // fixed128 is more precise than fixed64 but costs more than perturbation
+  check_auto(1e-8, arith_perturbation);
+  check_auto(1e-12, arith_perturbation);
+  check_auto(1e-40, arith_perturbation);
+  MandelbrotJobFactory m;
+  // Beyond the precision of double
+  compare(m, "-0.743643887037158704752191506114774", "0.131825904205311970493132056385139", "1e-20", 10000);
+  // The reference escapes early, so points must be rebased when they outlive
+  // it
+  compare(m, "-0.74364388", "0.13182590", "1e-6", 3000);
+  check_series("-0.743643887037158704752191506114774", "0.131825904205311970493132056385139", 1e-20, 10000);
+  JuliaJobFactory j;
+  j.cx = arith_t(-0.123);
+  j.cy = arith_t(0.745);
+  compare(j, "0.3394092212675588", "0.1", "1e-8", 3000);
+  check_reuse();
+  check_cancel();
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,73 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "Job.h"
+#include <ctime>
+
+// A job that does a small, fixed amount of work
+class SpinJob: public Job {
+public:
+  void work() {
+    volatile int n = 0;
+    while(n < 1000)
+      n = n + 1;
+  }
+};
+
+static void completed(Job *, void *) {}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// Measure the overhead of submitting and waiting for one small job per 32x32
+// tile of a large image.  If a batch size is given, completions are collected
+// the way the GUI does, by calling Job::poll(batch) until nothing is pending.
+int main(int argc, char **argv) {
+  int width = 16384, height = 16384, nthreads = -1, batch = 0;
+  if(argc > 1)
+    width = atoi(argv[1]);
+  if(argc > 2)
+    height = atoi(argv[2]);
+  if(argc > 3)
+    nthreads = atoi(argv[3]);
+  if(argc > 4)
+    batch = atoi(argv[4]);
+  Job::init(nthreads);
+  const int jobs = ((width + 31) / 32) * ((height + 31) / 32);
+  int owner;
+  double begin = now();
+  for(int n = 0; n < jobs; ++n)
+    (new SpinJob())->submit(completed, &owner);
+  double submitted = now();
+  if(batch > 0) {
+    while(Job::pending(&owner))
+      Job::poll(batch);
+  } else
+    Job::poll(&owner);
+  double finished = now();
+  Job::destroy();
+  printf("%dx%d: %d jobs; submit %.3fs; wait %.3fs; %.0f jobs/second\n",
+         width,
+         height,
+         jobs,
+         submitted - begin,
+         finished - submitted,
+         jobs / (finished - begin));
+  return 0;
+}
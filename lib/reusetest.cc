@@ -0,0 +1,112 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static void completed(Job *, void *) {}
+
+static const int width = 96, height = 64, maxiters = 1000;
+
+static IterBuffer *render(FractalJobFactory &jf,
+                          arith_t cx,
+                          arith_t cy,
+                          arith_t r,
+                          arith_type arith,
+                          IterBuffer *previous = nullptr,
+                          int dx = 0,
+                          int dy = 0,
+                          int zoom = 0) {
+  IterBuffer *dest = FractalJob::recompute(
+      cx, cy, r, maxiters, width, height, arith, completed, &jf, 0, 0, &jf, job_interactive, 1, previous, dx, dy, zoom);
+  Job::poll(&jf);
+  return dest;
+}
+
+// Move the view as mmui's View::Drag (zoom = 0) or View::Zoom2 does, render
+// it reusing the previous image, and check that the result is exactly what
+// rendering it from scratch gives.  The pixels copied from the previous image
+// must already be right on their own.  Perturbation uses a reference orbit at
+// the center, which a zoom moves, so small differences are allowed.
+static void check(arith_type arith, int dx, int dy, int zoom) {
+  MandelbrotJobFactory jf;
+  arith_t cx(-0.75), cy(0.1), r(0.25);
+  IterBuffer *previous = render(jf, cx, cy, r, arith);
+  if(zoom)
+    ASSERT(FractalJob::zoom2(cx, cy, r, width, height, dx, dy, zoom));
+  else {
+    const arith_t pixel = FractalJob::pixel_size(r, width, height);
+    cx -= arith_t(dx) * pixel;
+    cy += arith_t(dy) * pixel;
+  }
+  IterBuffer *reused = render(jf, cx, cy, r, arith, previous, dx, dy, zoom);
+  IterBuffer *fresh = render(jf, cx, cy, r, arith);
+  IterBuffer *copied = new IterBuffer(width, height);
+  const int ncopied = copied->copy(previous, dx, dy, zoom);
+  const count_t tolerance = arith == arith_perturbation ? 1e-3 : 0;
+  int wrong = 0, wrong_copied = 0, counted = 0;
+  for(int py = 0; py < height; ++py)
+    for(int px = 0; px < width; ++px) {
+      if(!(fabs(reused->pixel(px, py) - fresh->pixel(px, py)) <= tolerance))
+        ++wrong;
+      if(!std::isnan(copied->pixel(px, py))) {
+        ++counted;
+        if(!(fabs(copied->pixel(px, py) - fresh->pixel(px, py)) <= tolerance))
+          ++wrong_copied;
+      }
+    }
+  printf("%s %d,%d zoom %d: %d copied, %d+%d wrong\n", arith_names[arith], dx, dy, zoom, ncopied, wrong_copied, wrong);
+  ASSERT(ncopied > 0);
+  ASSERT(counted == ncopied);
+  ASSERT(wrong_copied == 0);
+  ASSERT(wrong == 0);
+  previous->release();
+  reused->release();
+  fresh->release();
+  copied->release();
+}
+
+int main() {
+  Job::init(1);
+  for(int a = 0; a < arith_limit; ++a) {
+    if(a == arith_auto)
+      continue;
+    // Pans either way; zooms in about pixels at even and odd offsets from
+    // the center, and out
+    check((arith_type)a, 17, -5, 0);
+    check((arith_type)a, -40, 23, 0);
+    check((arith_type)a, 30, 20, 1);
+    check((arith_type)a, 31, 21, 1);
+    check((arith_type)a, 50, 10, -1);
+  }
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
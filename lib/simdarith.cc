@@ -15,6 +15,7 @@
  */
 #include "mandy.h"
 #include "simdarith.h"
+#include "arith.h"
 
 #if __amd64__ || __i386__
 #include <x86intrin.h>
@@ -139,8 +140,95 @@ static void escape_check(ivector &escaped_already,
   COND_UPDATEV(escape_r2, r2, escaped_this_time);
 }
 
+// Select a where m is false and b where it is true.  (COND_UPDATEV only works
+// for this in general where there's a blend instruction.)
+static inline vector select(vector a, vector b, ivector m) {
+  return (vector)(((ivector)a & ~m) | ((ivector)b & m));
+}
+
+// Vector version of the test in iterate_attracted()
+static inline ivector attracted(vector dZ2, vector saved_dZ2) {
+  return (dZ2 < interior_limit) & (saved_dZ2 < interior_limit) & (dZ2 < saved_dZ2 * interior_ratio);
+}
+
+// Lanes carry on iterating after they are finished, which can leave dZ2 in
+// the denormal range, where arithmetic is very slow.  So it is kept above a
+// floor, far below interior_limit.
+static inline void derivative_floor(vector &dZ2) {
+  const vector floor = {SIMD_REP(1e-280)};
+  dZ2 = select(dZ2, floor, dZ2 < floor);
+}
+
+// Record lanes found to be interior, with their rates (see iterate_rate())
+// in place of r2.  This is rare, so the rates are computed a lane at a time.
+static inline void interior_check(ivector &escaped_already,
+                                  ivector &escape_iters,
+                                  ivector interior,
+                                  int64_t iterations,
+                                  int64_t maxiters,
+                                  const vector &dZ2,
+                                  const vector &saved_dZ2,
+                                  vector &escape_r2) {
+  interior &= ~escaped_already;
+  if(NONZERO(~interior))
+    return;
+  vector rates;
+  for(int i = 0; i < SIMD; i++)
+    rates[i] = iterate_rate(iterations, dZ2[i], saved_dZ2[i]);
+  escape_check(escaped_already, escape_iters, interior, maxiters, rates, escape_r2);
+}
+
+// The derivatives of the lanes' orbits, for distance estimation (see struct
+// derivative)
+struct vector_derivative {
+  vector x, y, add;
+  vector ex, ey, ezx, ezy; // derivative and z as of the iteration each lane escaped
+
+  vector_derivative(bool mandelbrot):
+      x{SIMD_REP(mandelbrot ? 0.0 : 1.0)}, y{0}, add{SIMD_REP(mandelbrot ? 1.0 : 0.0)}, ex{0}, ey{0}, ezx{0}, ezy{0} {}
+
+  vector_derivative(const derivative *start): ex{0}, ey{0}, ezx{0}, ezy{0} {
+    for(int i = 0; i < SIMD; i++) {
+      x[i] = start[i].x;
+      y[i] = start[i].y;
+      add[i] = start[i].add;
+    }
+  }
+
+  // Update for an iteration from Z.  Must be called before escape_check().
+  inline void step(vector Zx, vector Zy, ivector escaped_already) {
+    ex = select(x, ex, escaped_already);
+    ey = select(y, ey, escaped_already);
+    ezx = select(Zx, ezx, escaped_already);
+    ezy = select(Zy, ezy, escaped_already);
+    const vector nx = 2 * (Zx * x - Zy * y) + add;
+    y = 2 * (Zx * y + Zy * x);
+    x = nx;
+  }
+
+  // Store distance estimates for lanes that escaped, continuing their orbits
+  // as in derivative::escape()
+  void distances(
+      double *distance_values, const int *iters, int maxiters, const double *cxvalues, const double *cyvalues) const {
+    for(int i = 0; i < SIMD; i++) {
+      if(iters[i] < maxiters) {
+        derivative d(false);
+        d.x = ex[i];
+        d.y = ey[i];
+        d.add = add[i];
+        d.escape(ezx[i], ezy[i], cxvalues[i], cyvalues[i]);
+        distance_values[i] = d.distance();
+      } else
+        distance_values[i] = 0;
+    }
+  }
+};
+
+template <bool distances, bool interior>
 static inline void simd_iterate_once(vector &Zx,
                                      vector &Zy,
+                                     vector &dZ2,
+                                     vector_derivative &D,
                                      vector &escape_r2,
                                      ivector &escaped_already,
                                      ivector &escape_iters,
@@ -151,14 +239,22 @@ static inline void simd_iterate_once(vector &Zx,
   const vector Zy2 = Zy * Zy;
   const vector r2 = Zx2 + Zy2;
   const ivector escaped = r2 >= (double)R2LIMIT; // -1 for points that escaped this time, or in the past; else 0
+  if(distances)
+    D.step(Zx, Zy, escaped_already);
   escape_check(escaped_already, escape_iters, escaped, iterations, r2, escape_r2);
   const vector Zxnew = Zx2 - Zy2 + Cx;
   const vector Zynew = 2 * Zx * Zy + Cy;
+  // See iterate_derivative().  This comes after the new Z so that Z is
+  // computed the same way with or without it; otherwise the compiler can fuse
+  // different multiplies and adds, and chaotic orbits come out differently.
+  if(interior && iterations)
+    dZ2 *= 4 * r2;
   Zx = Zxnew;
   Zy = Zynew;
   iterations++;
 }
 
+template <bool distances, bool interior>
 static inline void simd_iterate_core(const double *zxvalues,
                                      const double *zyvalues,
                                      const double *cxvalues,
@@ -166,7 +262,9 @@ static inline void simd_iterate_core(const double *zxvalues,
                                      int64_t maxiters,
                                      int *iters,
                                      double *r2values,
-                                     int mandelbrot) {
+                                     int mandelbrot,
+                                     const int *cancel,
+                                     double *distance_values) {
   const vector Cx = {VALUES(cxvalues)};
   const vector Cy = {VALUES(cyvalues)};
   vector Zx = {VALUES(zxvalues)};
@@ -175,30 +273,77 @@ static inline void simd_iterate_core(const double *zxvalues,
   ivector escape_iters = {SIMD_REP(0)};
   ivector escaped_already = {SIMD_REP(0)};
   int64_t iterations = 0;
+  vector savedx = Zx, savedy = Zy;
+  vector dZ2 = {SIMD_REP(1)}, saved_dZ2 = {SIMD_REP(HUGE_VAL)};
+  vector_derivative D(mandelbrot);
 
   if(mandelbrot) {
     const vector cxq = (Cx - 0.25);
     const vector cy2 = Cy * Cy;
     const vector q = cxq * cxq + cy2;
-    const ivector escaped = (4.0 * q * (q + cxq) < cy2) || (Cx * Cx + 2.0 * Cx + 1.0 + cy2 < 1.0 / 16.0);
-    vector r2 = {SIMD_REP(0)};
-    escape_check(escaped_already, escape_iters, escaped, maxiters, r2, escape_r2);
+    const ivector cardioid = 4.0 * q * (q + cxq) < cy2;
+    const ivector escaped = cardioid || (Cx * Cx + 2.0 * Cx + 1.0 + cy2 < 1.0 / 16.0);
+    vector rates = {SIMD_REP(0)};
+    if(!NONZERO(~escaped))
+      for(int i = 0; i < SIMD; i++)
+        if(escaped[i])
+          rates[i] = cardioid[i] ? cardioid_rate(Cx[i], Cy[i]) : bulb_rate(Cx[i], Cy[i]);
+    escape_check(escaped_already, escape_iters, escaped, maxiters, rates, escape_r2);
   }
 
   while(iterations < maxiters && !NONZERO(escaped_already)) {
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
-    simd_iterate_once(Zx, Zy, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    simd_iterate_once<distances, interior>(
+        Zx, Zy, dZ2, D, escape_r2, escaped_already, escape_iters, iterations, Cx, Cy);
+    // iterations advances in steps of 8, so this hits every multiple of
+    // CANCEL_INTERVAL
+    if(!(iterations & (CANCEL_INTERVAL - 1)) && cancel && ATOMIC_LOAD(*cancel)) {
+      for(int i = 0; i < SIMD; i++)
+        iters[i] = -1;
+      return;
+    }
+    // Periodicity checking and interior detection, as in defaultIterate.  A
+    // lane whose orbit has returned to its saved value, or been attracted to
+    // a cycle, is treated as escaping at maxiters.
+    const ivector periodic = (Zx == savedx) & (Zy == savedy);
+    if(interior) {
+      derivative_floor(dZ2);
+      interior_check(escaped_already, escape_iters, periodic, iterations, maxiters, dZ2, saved_dZ2, escape_r2);
+    } else {
+      const vector unknown = {SIMD_REP(1)};
+      escape_check(escaped_already, escape_iters, periodic, maxiters, unknown, escape_r2);
+    }
+    if(!(iterations & (iterations - 1))) {
+      if(interior) {
+        interior_check(
+            escaped_already, escape_iters, attracted(dZ2, saved_dZ2), iterations, maxiters, dZ2, saved_dZ2, escape_r2);
+        saved_dZ2 = dZ2;
+      }
+      savedx = Zx;
+      savedy = Zy;
+    }
   }
   const ivector maxiters_vector = {SIMD_REP(maxiters)};
+  const vector unknown = {SIMD_REP(1)};
   escape_iters |= maxiters_vector & ~escaped_already;
+  escape_r2 = select(escape_r2, unknown, ~escaped_already);
   ASSIGN(r2values, escape_r2);
   ASSIGN(iters, escape_iters);
+  if(distances)
+    D.distances(distance_values, iters, maxiters, cxvalues, cyvalues);
 }
 
 void simd_iterate(const double *zxvalues,
@@ -208,6 +353,110 @@ void simd_iterate(const double *zxvalues,
                   int maxiters,
                   int *iterations,
                   double *r2values,
-                  int mandelbrot) {
-  simd_iterate_core(zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, mandelbrot);
+                  int mandelbrot,
+                  const int *cancel,
+                  double *distances,
+                  bool interior) {
+  // The derivatives cost a good deal, so there are separate versions with
+  // and without them
+  if(distances) {
+    if(interior)
+      simd_iterate_core<true, true>(
+          zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, mandelbrot, cancel, distances);
+    else
+      simd_iterate_core<true, false>(
+          zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, mandelbrot, cancel, distances);
+  } else {
+    if(interior)
+      simd_iterate_core<false, true>(
+          zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, mandelbrot, cancel, nullptr);
+    else
+      simd_iterate_core<false, false>(
+          zxvalues, zyvalues, cxvalues, cyvalues, maxiters, iterations, r2values, mandelbrot, cancel, nullptr);
+  }
+}
+
+void simd_perturb(const double *zx,
+                  const double *zy,
+                  int last,
+                  int start,
+                  const double *dzxvalues,
+                  const double *dzyvalues,
+                  const double *dcxvalues,
+                  const double *dcyvalues,
+                  int maxiters,
+                  int *iters,
+                  double *r2values,
+                  const int *cancel,
+                  const derivative *derivatives,
+                  const double *cxvalues,
+                  const double *cyvalues,
+                  double *distances,
+                  bool interior) {
+  const vector dCx = {VALUES(dcxvalues)};
+  const vector dCy = {VALUES(dcyvalues)};
+  vector dZx = {VALUES(dzxvalues)};
+  vector dZy = {VALUES(dzyvalues)};
+  const vector Z0x = {SIMD_REP(zx[0])};
+  const vector Z0y = {SIMD_REP(zy[0])};
+  const ivector lastv = {SIMD_REP(last)};
+  ivector n = {SIMD_REP(start)}; // position of each lane in the reference orbit
+  vector escape_r2 = {0};
+  ivector escape_iters = {SIMD_REP(0)};
+  ivector escaped_already = {SIMD_REP(0)};
+  int64_t iterations = start;
+  // Interior detection as in ReferenceOrbit::iterate
+  vector dZ2 = {SIMD_REP(1)}, saved_dZ2 = {SIMD_REP(HUGE_VAL)};
+  vector_derivative D(false);
+  if(distances)
+    D = vector_derivative(derivatives);
+  while(iterations < maxiters && !NONZERO(escaped_already)) {
+    vector Zx, Zy;
+    for(int i = 0; i < SIMD; i++) {
+      Zx[i] = zx[n[i]];
+      Zy[i] = zy[n[i]];
+    }
+    const vector X = Zx + dZx, Y = Zy + dZy;
+    const vector r2 = X * X + Y * Y;
+    const ivector escaped = r2 >= (double)R2LIMIT;
+    if(distances)
+      D.step(X, Y, escaped_already);
+    escape_check(escaped_already, escape_iters, escaped, iterations, r2, escape_r2);
+    if(interior && iterations) {
+      dZ2 *= 4 * r2;
+      derivative_floor(dZ2);
+    }
+    // Rebase lanes that are nearer the start of the reference
+    const vector Ex = X - Z0x, Ey = Y - Z0y;
+    const ivector rebase = (n == lastv) | (Ex * Ex + Ey * Ey < dZx * dZx + dZy * dZy);
+    dZx = select(dZx, Ex, rebase);
+    dZy = select(dZy, Ey, rebase);
+    Zx = select(Zx, Z0x, rebase);
+    Zy = select(Zy, Z0y, rebase);
+    n &= ~rebase;
+    const vector Tx = 2 * Zx + dZx, Ty = 2 * Zy + dZy;
+    const vector dZxnew = Tx * dZx - Ty * dZy + dCx;
+    dZy = Tx * dZy + Ty * dZx + dCy;
+    dZx = dZxnew;
+    n += 1;
+    iterations++;
+    if(!(iterations & (CANCEL_INTERVAL - 1)) && cancel && ATOMIC_LOAD(*cancel)) {
+      for(int i = 0; i < SIMD; i++)
+        iters[i] = -1;
+      return;
+    }
+    if(interior && !(iterations & (iterations - 1))) {
+      interior_check(
+          escaped_already, escape_iters, attracted(dZ2, saved_dZ2), iterations, maxiters, dZ2, saved_dZ2, escape_r2);
+      saved_dZ2 = dZ2;
+    }
+  }
+  const ivector maxiters_vector = {SIMD_REP(maxiters)};
+  const vector unknown = {SIMD_REP(1)};
+  escape_iters |= maxiters_vector & ~escaped_already;
+  escape_r2 = select(escape_r2, unknown, ~escaped_already);
+  ASSIGN(r2values, escape_r2);
+  ASSIGN(iters, escape_iters);
+  if(distances)
+    D.distances(distances, iters, maxiters, cxvalues, cyvalues);
 }
@@ -16,6 +16,12 @@
 #ifndef SIMDARITH_H
 #define SIMDARITH_H
 
+struct derivative;
+
+// If distances is not null then distance estimates for points that escape
+// are stored there.  The derivative is with respect to c if mandelbrot is
+// nonzero, otherwise to z (see struct derivative).  interior is as for
+// defaultIterate().
 void simd_iterate(const double *zxvalues,
                   const double *zyvalues,
                   const double *cxvalues,
@@ -23,6 +29,32 @@ void simd_iterate(const double *zxvalues,
                   int maxiters,
                   int *iterations,
                   double *r2values,
-                  int mandelbrot);
+                  int mandelbrot,
+                  const int *cancel = nullptr,
+                  double *distances = nullptr,
+                  bool interior = false);
+
+// Iterate points as offsets from a reference orbit zx/zy, which has last+1
+// entries, starting at iteration start.  See ReferenceOrbit::iterate.  If
+// distances is not null then the orbits' derivatives start from derivatives,
+// and distance estimates for points that escape are stored there.  cxvalues
+// and cyvalues are then the points' full constants, for derivative::escape().
+void simd_perturb(const double *zx,
+                  const double *zy,
+                  int last,
+                  int start,
+                  const double *dzxvalues,
+                  const double *dzyvalues,
+                  const double *dcxvalues,
+                  const double *dcyvalues,
+                  int maxiters,
+                  int *iterations,
+                  double *r2values,
+                  const int *cancel = nullptr,
+                  const derivative *derivatives = nullptr,
+                  const double *cxvalues = nullptr,
+                  const double *cyvalues = nullptr,
+                  double *distances = nullptr,
+                  bool interior = false);
 
 #endif /* SIMDARITH_H */
@@ -34,6 +34,8 @@ int main(int argc, char **argv) {
     if(t == arith_simd)
       continue; // not supported by iterate()
 #endif
+    if(t == arith_perturbation || t == arith_auto)
+      continue; // needs a reference orbit or a view
     clock_t begin = clock();
     int zxi = 0, zyi = 0, cxi = 0, cyi = 0;
     for(int n = 0; n < repeats; ++n) {
@@ -0,0 +1,141 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include <algorithm>
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static void completed(Job *, void *) {}
+
+static const int width = 64, height = 48, grid = 2;
+
+// Render an image and its anti-aliasing passes, selecting every third pixel
+static IterBuffer *render(FractalJobFactory &jf,
+                          std::vector<IterBuffer *> &passes,
+                          std::vector<bool> &selected,
+                          const char *x,
+                          const char *y,
+                          const char *r,
+                          int maxiters,
+                          arith_type arith) {
+  arith_t cx, cy, radius;
+  char *end;
+  arith_traits<arith_t>::fromString(cx, x, &end);
+  arith_traits<arith_t>::fromString(cy, y, &end);
+  arith_traits<arith_t>::fromString(radius, r, &end);
+  IterBuffer *dest = FractalJob::recompute(cx, cy, radius, maxiters, width, height, arith, completed, &jf, 0, 0, &jf);
+  Job::poll(&jf);
+  selected.assign(width * height, false);
+  for(size_t n = 0; n < selected.size(); n += 3)
+    selected[n] = true;
+  FractalJob::supersample(passes, dest, selected, grid, cx, cy, radius, maxiters, arith, completed, &jf, &jf);
+  Job::poll(&jf);
+  return dest;
+}
+
+static void release(IterBuffer *image, std::vector<IterBuffer *> &passes) {
+  image->release();
+  for(size_t n = 0; n < passes.size(); ++n)
+    passes[n]->release();
+  passes.clear();
+}
+
+// Check that only selected pixels are resampled, and that the samples are
+// jittered within the pixel
+static void check_passes(const char *x, const char *y, const char *r, int maxiters, arith_type arith) {
+  MandelbrotJobFactory jf;
+  std::vector<IterBuffer *> passes;
+  std::vector<bool> selected;
+  IterBuffer *image = render(jf, passes, selected, x, y, r, maxiters, arith);
+  ASSERT(passes.size() == grid * grid);
+  int changed = 0, far = 0;
+  for(size_t n = 0; n < passes.size(); ++n)
+    for(int py = 0; py < height; ++py)
+      for(int px = 0; px < width; ++px) {
+        const count_t sample = passes[n]->pixel(px, py), center = image->pixel(px, py);
+        if(!selected[py * width + px])
+          ASSERT(sample == center);
+        else {
+          ASSERT(!std::isnan(sample));
+          if(sample != center)
+            ++changed;
+          // Samples are within the pixel, so in a smooth region they are
+          // within the range of its neighbours
+          if(px > 0 && py > 0 && px < width - 1 && py < height - 1) {
+            count_t low = center, high = center;
+            for(int ny = py - 1; ny <= py + 1; ++ny)
+              for(int nx = px - 1; nx <= px + 1; ++nx) {
+                low = std::min(low, image->pixel(nx, ny));
+                high = std::max(high, image->pixel(nx, ny));
+              }
+            if(sample < low || sample > high)
+              ++far;
+          }
+        }
+      }
+  printf("%s %s %s %s: %d samples changed, %d outside their neighbours\n", x, y, r, arith_names[arith], changed, far);
+  ASSERT(changed > 0);
+  ASSERT(far == 0);
+  release(image, passes);
+}
+
+// Compare the passes computed with perturbation against full precision
+static void compare(const char *x, const char *y, const char *r, int maxiters) {
+  MandelbrotJobFactory jf;
+  std::vector<IterBuffer *> perturbed, exact;
+  std::vector<bool> selected;
+  IterBuffer *perturbed_image = render(jf, perturbed, selected, x, y, r, maxiters, arith_perturbation);
+  IterBuffer *exact_image = render(jf, exact, selected, x, y, r, maxiters, arith_fixed256);
+  int wrong = 0, total = 0;
+  for(size_t n = 0; n < exact.size(); ++n)
+    for(int py = 0; py < height; ++py)
+      for(int px = 0; px < width; ++px)
+        if(selected[py * width + px]) {
+          if(fabs(perturbed[n]->pixel(px, py) - exact[n]->pixel(px, py)) > 0.01)
+            ++wrong;
+          ++total;
+        }
+  printf("%s %s %s: %d/%d samples differ\n", x, y, r, wrong, total);
+  ASSERT(wrong * 100 < total);
+  release(perturbed_image, perturbed);
+  release(exact_image, exact);
+}
+
+int main() {
+  Job::init(2);
+  // Entirely outside the set, where counts vary smoothly
+  check_passes("1", "1", "0.05", 255, arith_double);
+  check_passes("1", "1", "0.05", 255, arith_simd);
+  check_passes("1", "1", "0.05", 255, arith_fixed256);
+  compare("-0.74364388", "0.13182590", "1e-6", 3000);
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,146 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include "JuliaJob.h"
+#include <algorithm>
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+// The same fractals, without symmetry
+class PlainMandelbrotJobFactory: public MandelbrotJobFactory {
+public:
+  fractal_symmetry symmetry() const override {
+    return symmetry_none;
+  }
+};
+
+class PlainJuliaJobFactory: public JuliaJobFactory {
+public:
+  fractal_symmetry symmetry() const override {
+    return symmetry_none;
+  }
+};
+
+static int tiled; // pixels covered by delivered tiles
+
+static void completed(Job *job, void *) {
+  FractalJob *j = dynamic_cast<FractalJob *>(job);
+  tiled += j->w * j->h;
+}
+
+static const int width = 320, height = 240;
+
+static IterBuffer *render(const FractalJobFactory &jf, double x, double y, double r, int maxiters, arith_type arith) {
+  tiled = 0;
+  IterBuffer *dest = FractalJob::recompute(arith_t(x), arith_t(y), arith_t(r), maxiters, width, height, arith,
+                                           completed, (void *)&jf, 0, 0, &jf);
+  Job::poll((void *)&jf);
+  return dest;
+}
+
+// Render a view with and without symmetry.  If mirrored, the symmetric
+// render must skip part of the image, and otherwise compute all of it.
+//
+// Copied pixels are exact copies, so if the symmetric partner of (px, py) is
+// known to be (sx - px, sy - py) (with -1 for an axis that isn't mirrored),
+// the symmetric render must be exactly symmetric, except along the row on
+// the real axis, which is computed on both sides.  The arithmetic itself is
+// not quite symmetric, so the two renders differ by rounding, and
+// occasionally by more where an orbit is chaotic or a Mariani-Silver fill
+// lands differently.  At most 1 pixel in 1000 may differ by more than 1 part
+// in 10^6.
+static void compare(const FractalJobFactory &symmetric,
+                    const FractalJobFactory &plain,
+                    const char *what,
+                    double x,
+                    double y,
+                    double r,
+                    int maxiters,
+                    arith_type arith,
+                    bool mirrored,
+                    int sx = -1,
+                    int sy = -1) {
+  IterBuffer *a = render(symmetric, x, y, r, maxiters, arith);
+  const int computed = tiled;
+  IterBuffer *b = render(plain, x, y, r, maxiters, arith);
+  int wrong = 0, asymmetric = 0;
+  for(int py = 0; py < height; ++py)
+    for(int px = 0; px < width; ++px) {
+      const count_t ca = a->pixel(px, py), cb = b->pixel(px, py);
+      if(!(fabs(ca - cb) <= 1e-6 * std::max(cb, count_t(1))))
+        ++wrong;
+      const int qx = sx >= 0 ? sx - px : px, qy = sy >= 0 ? sy - py : py;
+      if(mirrored && qx >= 0 && qx < width && qy >= 0 && qy < height && qy != py && !(a->pixel(qx, qy) == ca))
+        ++asymmetric;
+    }
+  printf("%s %s: %d/%d pixels computed, %d differ, %d asymmetric\n",
+         what,
+         arith_names[arith],
+         computed,
+         width * height,
+         wrong,
+         asymmetric);
+  if(mirrored)
+    ASSERT(computed < width * height);
+  else
+    ASSERT(computed == width * height);
+  ASSERT(wrong <= width * height / 1000);
+  ASSERT(asymmetric == 0);
+  a->release();
+  b->release();
+}
+
+int main() {
+  Job::init(1);
+  MandelbrotJobFactory m;
+  PlainMandelbrotJobFactory pm;
+  JuliaJobFactory j;
+  PlainJuliaJobFactory pj;
+  j.cx = pj.cx = arith_t(-0.123);
+  j.cy = pj.cy = arith_t(0.745);
+  // Row py is at y = r - (py + 1) * pixel, so the real axis is row h / 2 - 1
+  // when the view is centred on it.  Column px is at x = (px - w / 2) *
+  // pixel from the center.
+  for(int a = 0; a < arith_limit; ++a) {
+    if(a == arith_auto || a == arith_perturbation)
+      continue;
+    compare(m, pm, "mandelbrot on axis", -0.5, 0, 1.2, 1000, (arith_type)a, true, -1, height - 2);
+    compare(m, pm, "mandelbrot near axis", -0.75, 0.05, 0.1, 1000, (arith_type)a, true);
+    compare(m, pm, "mandelbrot off axis", -0.5, 0.3, 0.1, 1000, (arith_type)a, false);
+    compare(j, pj, "julia on center", 0, 0, 1.2, 1000, (arith_type)a, true, width, height - 2);
+    compare(j, pj, "julia off center", 0.4, 0.3, 0.2, 1000, (arith_type)a, false);
+  }
+  // Perturbation is only meant for deep zooms
+  compare(m, pm, "mandelbrot on axis", -1.7687788, 0, 1e-6, 3000, arith_perturbation, true, -1, height - 2);
+  compare(m, pm, "mandelbrot off axis", -1.7687788, 2e-6, 1e-6, 3000, arith_perturbation, false);
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
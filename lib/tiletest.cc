@@ -0,0 +1,91 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static void completed(Job *, void *) {}
+
+// Occupies a worker until released
+class BlockJob: public Job {
+public:
+  static ATOMIC_TYPE started, released;
+  void work() {
+    ATOMIC_INC(started);
+    while(!ATOMIC_GET(released))
+      ;
+  }
+};
+
+ATOMIC_TYPE BlockJob::started, BlockJob::released;
+
+static const int width = 256, height = 256, maxiters = 5000;
+static const arith_type arith = arith_fixed128;
+
+static IterBuffer *render(FractalJobFactory &jf) {
+  return FractalJob::recompute(arith_t(-0.75), arith_t(0.1), arith_t(0.05), maxiters, width, height, arith, completed,
+                               &jf, 0, 0, &jf);
+}
+
+// A render that is cancelled before its tiles run has nothing to say about
+// how long they take, so the tile size must not change.  Counting the
+// discarded tiles as having taken no time would drag the estimate down, so
+// that later images get huge tiles that make cancelling them slow (or, with
+// no real timings at all, lose the estimate altogether).
+static void check_cancel() {
+  MandelbrotJobFactory jf;
+  IterBuffer *dest = render(jf);
+  Job::poll(&jf);
+  dest->release();
+  const int measured = jf.tile_size(width, height, maxiters, arith);
+  // Hold the only worker, so that none of the tiles can start
+  int blocker;
+  (new BlockJob())->submit(completed, &blocker);
+  while(!ATOMIC_GET(BlockJob::started))
+    ;
+  dest = render(jf);
+  Job::cancel(&jf);
+  ATOMIC_INC(BlockJob::released);
+  Job::poll(&jf);
+  Job::poll(&blocker);
+  dest->release();
+  const int after = jf.tile_size(width, height, maxiters, arith);
+  printf("tile size %d after a full render, %d after a cancelled one\n", measured, after);
+  ASSERT(measured < FractalJobFactory::max_tile / 2);
+  ASSERT(after == measured);
+}
+
+int main() {
+  Job::init(1);
+  check_cancel();
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
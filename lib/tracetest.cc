@@ -0,0 +1,96 @@
+/* Copyright © Richard Kettlewell.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mandy.h"
+#include "MandelbrotJob.h"
+#include "JuliaJob.h"
+#include <cstdio>
+
+static int errors;
+
+#define ASSERT(expr)                                                                                                   \
+  (void)(expr ? 0 : (++errors, fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #expr)))
+
+static int evaluated;
+
+static void completed(Job *job, void *) {
+  evaluated += static_cast<FractalJob *>(job)->evaluated;
+}
+
+static const int width = 320, height = 240;
+
+static IterBuffer *render(const FractalJobFactory &jf, double x, double y, double r, int maxiters, arith_type arith) {
+  evaluated = 0;
+  IterBuffer *dest = FractalJob::recompute(arith_t(x), arith_t(y), arith_t(r), maxiters, width, height, arith,
+                                           completed, (void *)&jf, 0, 0, &jf);
+  Job::poll((void *)&jf);
+  return dest;
+}
+
+// Render a view by boundary tracing and by subdivision.  Tracing must skip
+// some of the image, and fill the rest with the same values.  Either method
+// can miss a filament too thin to cross any of the pixels it computes, so at
+// most 1 pixel in 1000 may differ.
+static void check(FractalJobFactory &traced,
+                  const FractalJobFactory &subdivided,
+                  const char *what,
+                  double x,
+                  double y,
+                  double r,
+                  int maxiters,
+                  arith_type arith) {
+  traced.strategy = strategy_trace;
+  IterBuffer *a = render(traced, x, y, r, maxiters, arith);
+  const int computed = evaluated;
+  IterBuffer *b = render(subdivided, x, y, r, maxiters, arith);
+  int differ = 0;
+  for(int py = 0; py < height; ++py)
+    for(int px = 0; px < width; ++px)
+      if(!(a->pixel(px, py) == b->pixel(px, py)))
+        ++differ;
+  printf("%s %s: %d/%d pixels computed, %d differ\n", what, arith_names[arith], computed, width * height, differ);
+  ASSERT(computed < width * height);
+  ASSERT(differ <= width * height / 1000);
+  a->release();
+  b->release();
+}
+
+int main() {
+  Job::init(1);
+  for(int a = 0; a < arith_limit; ++a) {
+    if(a == arith_auto || a == arith_perturbation)
+      continue;
+    MandelbrotJobFactory m, sm;
+    JuliaJobFactory j, sj;
+    j.cx = sj.cx = arith_t(-0.123);
+    j.cy = sj.cy = arith_t(0.745);
+    check(m, sm, "mandelbrot", -0.75, 0, 1.5, 255, (arith_type)a);
+    check(m, sm, "mandelbrot", -1.25, 0.05, 0.1, 4096, (arith_type)a);
+    check(m, sm, "mandelbrot", -0.1, 0.8, 0.2, 4096, (arith_type)a);
+    check(j, sj, "julia", 0, 0, 1.2, 1000, (arith_type)a);
+  }
+  Job::destroy();
+  return !!errors;
+}
+
+/*
+Local Variables:
+mode:c++
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/